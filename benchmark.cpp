@@ -0,0 +1,1257 @@
+#include <malloc.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "string_view.h"
+#include "matcher.h"
+#include "string_map.h"
+#include "memory_pool.h"
+#include "finalizer.h"
+#include "epoch.h"
+#include "stream.h"
+#include "event_loop.h"
+#include "queue.h"
+#include "serialize.h"
+#include "utils.h"
+
+// keeps the compiler from eliding work on p
+inline void escape(void* p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+template <typename F>
+double bench(const char* name, size_t iterations, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    printf("%-40s %12.2f ns/op\n", name, ns);
+    return ns;
+}
+
+// the pre-Searcher StringView::find, kept as a baseline
+size_t naive_find(StringView h, StringView v) {
+    if (v.size() > h.size()) {
+        return StringView::npos;
+    }
+    for (size_t i = 0; i + v.size() <= h.size(); ++i) {
+        if (memcmp(h.data() + i, v.data(), v.size()) == 0) {
+            return i;
+        }
+    }
+    return StringView::npos;
+}
+
+void bench_string_view_find() {
+    std::string text;
+    for (size_t i = 0; text.size() < (1 << 16); i++) {
+        text.append("2021-02-01 12:00:00 INFO request id=");
+        text.append(std::to_string(i));
+        text.append(" status=ok\n");
+    }
+    std::string short_needle("status=fail");
+    std::string long_needle("2021-02-01 12:00:00 ERROR request id=1 status=fail");
+    text.append(long_needle);
+
+    StringView haystack(text);
+    StringView sn(short_needle);
+    StringView ln(long_needle);
+    Searcher searcher(ln);
+    volatile size_t sink = 0;
+
+    bench("find/short/naive", 200, [&](size_t) { sink = naive_find(haystack, sn); });
+    bench("find/short/StringView::find", 200, [&](size_t) { sink = haystack.find(sn); });
+    bench("find/long/naive", 200, [&](size_t) { sink = naive_find(haystack, ln); });
+    bench("find/long/StringView::find", 200, [&](size_t) { sink = haystack.find(ln); });
+    bench("find/long/Searcher", 200, [&](size_t) { sink = searcher.find(haystack); });
+    (void)sink;
+}
+
+void bench_multi_matcher() {
+    std::vector<std::string> keywords;
+    for (size_t i = 0; i < 200; i++) {
+        keywords.push_back("keyword_" + std::to_string(i * 7919));
+    }
+    std::string text;
+    for (size_t i = 0; text.size() < (1 << 16); i++) {
+        text.append("user=");
+        text.append(std::to_string(i));
+        text.append(i % 97 == 0 ? " keyword_7919 " : " nothing_here ");
+        text.append("path=/api/v1/items\n");
+    }
+
+    StringView haystack(text);
+    std::vector<Searcher> searchers;
+    for (const auto& keyword : keywords) {
+        searchers.emplace_back(StringView(keyword));
+    }
+    MultiMatcher matcher(keywords);
+    volatile size_t sink = 0;
+
+    bench("multi/200 keywords/Searcher each", 20, [&](size_t) {
+        size_t hits = 0;
+        for (const auto& searcher : searchers) {
+            for (size_t pos = searcher.find(haystack); pos != StringView::npos;
+                 pos = searcher.find(haystack, pos + 1)) {
+                hits++;
+            }
+        }
+        sink = hits;
+    });
+    bench("multi/200 keywords/MultiMatcher", 20, [&](size_t) {
+        size_t hits = 0;
+        matcher.scan(haystack, [&hits](const MultiMatcher::Match&) { hits++; });
+        sink = hits;
+    });
+    (void)sink;
+}
+
+// the pre-Hash64 std::hash<StringView>, kept as a baseline
+struct Hash131 {
+    size_t operator()(const std::string& str) const {
+        size_t result = 0;
+        for (auto ch : str) {
+            result = (result * 131) + ch;
+        }
+        return result;
+    }
+};
+
+void bench_string_hash() {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 10000; i++) {
+        keys.push_back("runoob_column_name_" + std::to_string(i * 31));
+    }
+    std::string long_key(4096, 'x');
+    volatile uint64_t sink = 0;
+
+    bench("hash/4K key/h*131+c", 10000, [&](size_t) { sink = Hash131()(long_key); });
+    bench("hash/4K key/Hash64", 10000, [&](size_t) { sink = utils::Hash64(long_key); });
+
+    std::unordered_map<std::string, size_t> std_map;
+    utils::StringMap<size_t> string_map;
+    for (size_t i = 0; i < keys.size(); i++) {
+        std_map[keys[i]] = i;
+        string_map[keys[i]] = i;
+    }
+    // probes arrive as C strings, as they do for line["id"] / row["name"]
+    bench("lookup/unordered_map<string> const char*", 1000000, [&](size_t i) {
+        sink = std_map.find(keys[i % keys.size()].c_str())->second;
+    });
+    bench("lookup/StringMap const char*", 1000000, [&](size_t i) {
+        sink = string_map.find(keys[i % keys.size()].c_str())->second;
+    });
+    (void)sink;
+}
+
+// the pre-free-list MemoryPool: find_node scans for a node not in use
+class LegacyMemoryPool {
+public:
+    struct Node {
+        char block[512];
+        bool is_use = false;
+        Node* next = nullptr;
+    };
+
+    ~LegacyMemoryPool() {
+        while (head_) {
+            Node* tmp = head_;
+            head_ = head_->next;
+            delete tmp;
+        }
+    }
+
+    void init(size_t count) {
+        Node** cur = &head_;
+        for (size_t i = 0; i < count; i++) {
+            *cur = new Node();
+            cur = &((*cur)->next);
+        }
+    }
+
+    template <typename T>
+    T* find_node() {
+        Node* node = head_;
+        while (node && node->is_use) {
+            node = node->next;
+        }
+        if (!node) {
+            return nullptr;
+        }
+        node->is_use = true;
+        return new(node->block) T();
+    }
+
+    template <typename T>
+    void free_node(T* t) {
+        Node* node = reinterpret_cast<Node*>(t);
+        node->is_use = false;
+        memset(node->block, 0x00, sizeof(node->block));
+    }
+
+private:
+    Node* head_ = nullptr;
+};
+
+void reserve_ints(LegacyMemoryPool& pool, size_t count) {
+    pool.init(count);
+}
+
+void reserve_ints(memory_pool::MemoryPool& pool, size_t count) {
+    pool.reserve(sizeof(int), count);
+}
+
+template <typename Pool>
+void bench_pool_fill(const char* name, size_t percent) {
+    const size_t kNodes = 10000;
+    Pool pool;
+    reserve_ints(pool, kNodes);
+    std::vector<int*> held;
+    for (size_t i = 0; i < kNodes * percent / 100; i++) {
+        held.push_back(pool.template find_node<int>());
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s/%zu%% full", name, percent);
+    bench(label, 20000, [&](size_t) {
+        int* p = pool.template find_node<int>();
+        escape(p);
+        pool.free_node(p);
+    });
+    for (auto p : held) {
+        pool.free_node(p);
+    }
+}
+
+struct Small {
+    int64_t id;
+    double value;
+    char tag[16];
+};
+
+// allocate a working set of mixed small objects, then free it
+void bench_small_objects() {
+    const size_t kObjects = 1000;
+    memory_pool::MemoryPool pool;
+    pool.reserve(sizeof(int), kObjects);
+    pool.reserve(sizeof(Small), kObjects);
+    LegacyMemoryPool legacy;
+    legacy.init(2 * kObjects);
+    std::vector<int*> ints(kObjects);
+    std::vector<Small*> smalls(kObjects);
+
+    bench("small objects/malloc", 200, [&](size_t) {
+        for (size_t i = 0; i < kObjects; i++) {
+            ints[i] = new int(1);
+            smalls[i] = new Small();
+        }
+        for (size_t i = 0; i < kObjects; i++) {
+            delete ints[i];
+            delete smalls[i];
+        }
+    });
+    bench("small objects/legacy pool", 200, [&](size_t) {
+        for (size_t i = 0; i < kObjects; i++) {
+            ints[i] = legacy.find_node<int>();
+            smalls[i] = legacy.find_node<Small>();
+        }
+        for (size_t i = 0; i < kObjects; i++) {
+            legacy.free_node(ints[i]);
+            legacy.free_node(smalls[i]);
+        }
+    });
+    bench("small objects/size-class pool", 200, [&](size_t) {
+        for (size_t i = 0; i < kObjects; i++) {
+            ints[i] = pool.find_node<int>(1);
+            smalls[i] = pool.find_node<Small>();
+        }
+        for (size_t i = 0; i < kObjects; i++) {
+            pool.free_node(ints[i]);
+            pool.free_node(smalls[i]);
+        }
+    });
+    // malloc pays its usable size plus a size_t chunk header
+    int* i = new int(1);
+    Small* small = new Small();
+    size_t malloc_bytes = malloc_usable_size(i) + malloc_usable_size(small) + 2 * sizeof(size_t);
+    delete i;
+    delete small;
+    printf("bytes per int+Small: legacy %zu, malloc %zu, size-class pool %zu\n",
+           2 * sizeof(LegacyMemoryPool::Node), malloc_bytes,
+           memory_pool::ClassSize(memory_pool::SizeClass(sizeof(int))) +
+           memory_pool::ClassSize(memory_pool::SizeClass(sizeof(Small))));
+}
+
+void bench_pool_init() {
+    const size_t kNodes = 100000;
+    bench("init 100k nodes/legacy new per node", 5, [&](size_t) {
+        LegacyMemoryPool pool;
+        pool.init(kNodes);
+    });
+    bench("init 100k nodes/64 KB slabs", 5, [&](size_t) {
+        memory_pool::MemoryPool pool;
+        pool.reserve(sizeof(int), kNodes);
+    });
+    bench("init 100k nodes/2 MB slabs", 5, [&](size_t) {
+        memory_pool::PoolOptions options;
+        options.slab_size = 2 * 1024 * 1024;
+        memory_pool::MemoryPool pool(options);
+        pool.reserve(sizeof(int), kNodes);
+    });
+}
+
+void bench_memory_pool() {
+    bench_pool_init();
+    for (size_t percent : {1, 50, 99}) {
+        bench_pool_fill<LegacyMemoryPool>("pool/legacy scan", percent);
+        bench_pool_fill<memory_pool::MemoryPool>("pool/free list", percent);
+    }
+    bench_small_objects();
+}
+
+// every thread runs rounds of kBatch allocs then kBatch frees; prints wall
+// time per round trip of one thread, flat across thread counts means the
+// allocator scales linearly
+template <typename Alloc, typename Free>
+void bench_threads(const char* name, size_t threads, Alloc alloc, Free free_fn) {
+    const size_t kRounds = 2000;
+    const size_t kBatch = 64;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            std::vector<Small*> live(kBatch);
+            for (size_t r = 0; r < kRounds; r++) {
+                for (auto& p : live) {
+                    p = alloc();
+                    escape(p);
+                }
+                for (auto p : live) {
+                    free_fn(p);
+                }
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (kRounds * kBatch);
+    printf("%-32s threads=%zu %10.2f ns/op\n", name, threads, ns);
+}
+
+// one thread allocates, another frees each object as soon as it is
+// published, both running at once
+template <typename Alloc, typename Free>
+void bench_handoff(const char* name, Alloc alloc, Free free_fn) {
+    const size_t kObjects = 200000;
+    std::vector<Small*> objects(kObjects);
+    std::atomic<size_t> published{0};
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        for (size_t i = 0; i < kObjects; i++) {
+            objects[i] = alloc();
+            published.store(i + 1, std::memory_order_release);
+        }
+    });
+    std::thread consumer([&]() {
+        for (size_t i = 0; i < kObjects;) {
+            size_t end = published.load(std::memory_order_acquire);
+            if (end == i) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (; i < end; i++) {
+                free_fn(objects[i]);
+            }
+        }
+    });
+    producer.join();
+    consumer.join();
+    auto end = std::chrono::steady_clock::now();
+    printf("%-40s %12.2f ns/op\n", name,
+           std::chrono::duration<double, std::nano>(end - start).count() / kObjects);
+}
+
+void bench_concurrent_pool() {
+    memory_pool::ConcurrentMemoryPool pool;
+    memory_pool::MemoryPool locked;
+    std::mutex mutex;
+    locked.reserve(sizeof(Small), 200000);
+
+    auto pool_alloc = [&]() { return pool.find_node<Small>(); };
+    auto pool_free = [&](Small* p) { pool.free_node(p); };
+    auto locked_alloc = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return locked.find_node<Small>();
+    };
+    auto locked_free = [&](Small* p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        locked.free_node(p);
+    };
+    auto malloc_alloc = []() { return new Small(); };
+    auto malloc_free = [](Small* p) { delete p; };
+
+    for (size_t threads : {1, 2, 4, 8}) {
+        bench_threads("threads/malloc", threads, malloc_alloc, malloc_free);
+        bench_threads("threads/mutex+MemoryPool", threads, locked_alloc, locked_free);
+        bench_threads("threads/ConcurrentMemoryPool", threads, pool_alloc, pool_free);
+    }
+    bench_handoff("handoff/malloc", malloc_alloc, malloc_free);
+    bench_handoff("handoff/mutex+MemoryPool", locked_alloc, locked_free);
+    bench_handoff("handoff/ConcurrentMemoryPool", pool_alloc, pool_free);
+}
+
+// CSVParse style index: concatenated key columns -> row number
+void bench_pool_allocator() {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 20000; i++) {
+        keys.push_back(std::to_string(i) + "meixi" + std::to_string(i % 97));
+    }
+
+    using Pair = std::pair<const std::string, size_t>;
+    using PooledIndex = std::unordered_map<std::string, size_t, utils::StringHash,
+            std::equal_to<std::string>, memory_pool::PoolAllocator<Pair>>;
+    using HeapIndex = std::unordered_map<std::string, size_t, utils::StringHash>;
+    memory_pool::MemoryPool pool;
+
+    bench("csv index build/std::allocator", 20, [&](size_t) {
+        HeapIndex index;
+        for (size_t i = 0; i < keys.size(); i++) {
+            index[keys[i]] = i;
+        }
+    });
+    bench("csv index build/PoolAllocator", 20, [&](size_t) {
+        PooledIndex index(16, utils::StringHash(), std::equal_to<std::string>(),
+                          memory_pool::PoolAllocator<Pair>(pool));
+        for (size_t i = 0; i < keys.size(); i++) {
+            index[keys[i]] = i;
+        }
+    });
+    bench("list 20k push+clear/std::allocator", 20, [&](size_t) {
+        std::list<size_t> list;
+        for (size_t i = 0; i < keys.size(); i++) {
+            list.push_back(i);
+        }
+    });
+    bench("list 20k push+clear/PoolAllocator", 20, [&](size_t) {
+        std::list<size_t, memory_pool::PoolAllocator<size_t>> list{memory_pool::PoolAllocator<size_t>(pool)};
+        for (size_t i = 0; i < keys.size(); i++) {
+            list.push_back(i);
+        }
+    });
+}
+
+// a request splitting its input into a vector of strings and dropping it
+void bench_arena() {
+    using ArenaString = std::basic_string<char, std::char_traits<char>, memory_pool::ArenaAllocator<char>>;
+    using ArenaVector = std::vector<ArenaString, memory_pool::ArenaAllocator<ArenaString>>;
+    std::string input;
+    for (size_t i = 0; i < 200; i++) {
+        input.append("runoob_column_value_" + std::to_string(i) + ",");
+    }
+    memory_pool::Arena arena;
+    volatile size_t sink = 0;
+
+    bench("request split/malloc", 2000, [&](size_t) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for (size_t pos = input.find(','); pos != std::string::npos; pos = input.find(',', start)) {
+            fields.emplace_back(input.data() + start, pos - start);
+            start = pos + 1;
+        }
+        sink = fields.size();
+    });
+    bench("request split/arena", 2000, [&](size_t) {
+        memory_pool::ArenaScope scope(arena);
+        memory_pool::ArenaAllocator<char> alloc(arena);
+        ArenaVector fields{memory_pool::ArenaAllocator<ArenaString>(arena)};
+        size_t start = 0;
+        for (size_t pos = input.find(','); pos != std::string::npos; pos = input.find(',', start)) {
+            fields.emplace_back(input.data() + start, pos - start, alloc);
+            start = pos + 1;
+        }
+        sink = fields.size();
+    });
+    (void)sink;
+}
+
+struct Message {
+    void clear() {
+        body.clear();
+        fields.clear();
+    }
+
+    std::string body;
+    std::vector<std::string> fields;
+};
+
+void fill(Message& msg) {
+    msg.body.assign(256, 'x');
+    for (size_t i = 0; i < 8; i++) {
+        msg.fields.emplace_back("runoob_column_value_", 20);
+    }
+}
+
+void bench_object_pool() {
+    memory_pool::ObjectPool<Message> recycling(16);
+    memory_pool::ObjectPool<Message> plain;
+
+    bench("object/new+delete", 100000, [&](size_t) {
+        std::unique_ptr<Message> msg(new Message());
+        fill(*msg);
+    });
+    bench("object/ObjectPool make", 100000, [&](size_t) {
+        auto msg = plain.make();
+        fill(*msg);
+    });
+    bench("object/ObjectPool acquire (recycled)", 100000, [&](size_t) {
+        auto msg = recycling.acquire();
+        fill(*msg);
+    });
+}
+
+struct Chained {
+    Chained* next;
+    char payload[56];
+};
+
+// chases pointers through a pool of 256 MB in random order, so nearly
+// every step is a cache miss and most are TLB misses unless huge pages
+// back the slabs
+void bench_slab_backing(const char* name, const memory_pool::PoolOptions& options) {
+    const size_t kNodes = 4 * 1024 * 1024;
+    memory_pool::MemoryPool pool(options);
+    pool.reserve(sizeof(Chained), kNodes);
+    std::vector<Chained*> nodes(kNodes);
+    for (auto& node : nodes) {
+        node = pool.find_node<Chained>();
+    }
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = kNodes - 1; i > 0; i--) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::swap(nodes[i], nodes[x % (i + 1)]);
+    }
+    for (size_t i = 0; i < kNodes; i++) {
+        nodes[i]->next = nodes[(i + 1) % kNodes];
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "random access/%s", name);
+    Chained* p = nodes[0];
+    bench(label, kNodes, [&](size_t) {
+        p = p->next;
+    });
+    escape(p);
+    for (auto node : nodes) {
+        pool.free_node(node);
+    }
+}
+
+void bench_slab_backings() {
+    memory_pool::PoolOptions options;
+    options.slab_size = 2 * 1024 * 1024;
+    bench_slab_backing("heap", options);
+    options.backing = memory_pool::SlabBacking::kMmap;
+    bench_slab_backing("mmap+madvise", options);
+    options.backing = memory_pool::SlabBacking::kHugePages;
+    bench_slab_backing("MAP_HUGETLB", options);
+    options.numa_local = true;
+    bench_slab_backing("MAP_HUGETLB+numa_local", options);
+}
+
+void bench_scope_guard() {
+    size_t count = 0;
+    bench("scope/Finalizer", 1000000, [&](size_t) {
+        Finalizer finalizer([&count]() { count++; });
+        escape(&count);
+    });
+    bench("scope/ScopeGuard", 1000000, [&](size_t) {
+        auto guard = MakeScopeGuard([&count]() { count++; });
+        escape(&count);
+    });
+}
+
+void bench_epoch() {
+    utils::EpochDomain domain;
+    bench("epoch/pin+unpin", 1000000, [&](size_t) {
+        auto guard = domain.pin();
+        escape(&guard);
+    });
+
+    memory_pool::ConcurrentMemoryPool pool;
+    bench("epoch/retire pooled node", 1000000, [&](size_t) {
+        domain.retire_node(pool.find_node<Small>(), pool);
+    });
+    domain.drain();
+}
+
+// the pre-accounting Stream, kept as a baseline: GetRemaining walks the
+// list and CleanBuffers frees at most one buffer
+struct LegacyStream {
+    ~LegacyStream() {
+        while (head) {
+            Buffer *p = head;
+            head = head->next;
+            delete p;
+        }
+    }
+
+    size_t GetRemaining() {
+        size_t remaining = 0;
+        for (Buffer *p = head; p; p = p->next) {
+            remaining += p->GetRemaining();
+        }
+        return remaining;
+    }
+
+    void Add(size_t size, char *data) {
+        Buffer *p = new Buffer(size, data);
+        if (!head)
+            head = p;
+        if (tail)
+            tail->next = p;
+        tail = p;
+    }
+
+    size_t GetBytes(uint8_t *buf, size_t size) {
+        Buffer *p = head;
+        size_t read = 0;
+        while (p && read < size) {
+            read += p->GetBytes(buf + read, size - read);
+            p = p->next;
+        }
+        CleanBuffers();
+        return read;
+    }
+
+    void CleanBuffers() {
+        if (head && head->GetRemaining() == 0) {
+            Buffer *p = head;
+            head = head->next;
+            if (tail == p)
+                tail = nullptr;
+            delete p;
+        }
+    }
+
+    Buffer *head = nullptr;
+    Buffer *tail = nullptr;
+};
+
+// queues a backlog of length-prefixed frames, one buffer each, then parses
+// them the way Handler does; prints time per backlog
+template <typename S>
+void bench_stream_parse(const char* name, size_t backlog) {
+    char frame[13] = {12};
+    memcpy(frame + 1, "hello world!", 12);
+    uint8_t payload[255];
+    char label[64];
+    snprintf(label, sizeof(label), "%s/backlog %zu", name, backlog);
+    const size_t kRounds = 40000 / backlog + 1;
+    bench(label, kRounds, [&](size_t) {
+        S stream;
+        for (size_t i = 0; i < backlog; i++) {
+            stream.Add(sizeof(frame), frame);
+        }
+        uint8_t size = 0;
+        while (true) {
+            if (size == 0 && stream.GetRemaining() > sizeof(size)) {
+                stream.GetBytes(&size, sizeof(size));
+            }
+            if (size && stream.GetRemaining() >= size) {
+                stream.GetBytes(payload, size);
+                escape(payload);
+                size = 0;
+            } else {
+                break;
+            }
+        }
+    });
+}
+
+void bench_stream() {
+    for (size_t backlog : {16, 256, 4096}) {
+        bench_stream_parse<LegacyStream>("stream/legacy", backlog);
+        bench_stream_parse<Stream>("stream/counted", backlog);
+    }
+}
+
+// receive and read one 4 KB frame: copied in and out, or adopted and read
+// through a slice
+void bench_stream_zero_copy() {
+    static char frame[4096] = {1};
+    static uint8_t out[sizeof(frame)];
+    Stream stream;
+    bench("stream/Add+GetBytes 4 KB", 100000, [&](size_t) {
+        stream.Add(sizeof(frame), frame);
+        stream.GetBytes(out, sizeof(out));
+        escape(out);
+    });
+    bench("stream/Adopt+GetSlice 4 KB", 100000, [&](size_t) {
+        stream.Adopt(frame, sizeof(frame), [](char*, size_t, void*) {});
+        Slice slice = stream.GetSlice(sizeof(frame));
+        escape(&slice);
+    });
+    bench("stream/Adopt+GetSlice straddling", 100000, [&](size_t) {
+        stream.Adopt(frame, sizeof(frame) / 2, [](char*, size_t, void*) {});
+        stream.Adopt(frame, sizeof(frame) / 2, [](char*, size_t, void*) {});
+        Slice slice = stream.GetSlice(sizeof(frame));
+        escape(&slice);
+    });
+}
+
+// messages copied into a stream and read back, each with its own heap
+// buffer or packed into recycled 16 KB chunks; 200-byte ones as slices,
+// 64 KB ones, which span several chunks, copied out
+void bench_buffer_pool() {
+    static char message[64 * 1024] = {1};
+    static uint8_t out[sizeof(message)];
+    BufferPool pool;
+    Stream heap;
+    Stream pooled(&pool);
+    bench("stream/Add+GetSlice 200 B heap", 100000, [&](size_t) {
+        heap.Add(200, message);
+        Slice slice = heap.GetSlice(200);
+        escape(&slice);
+    });
+    bench("stream/Add+GetSlice 200 B pooled", 100000, [&](size_t) {
+        pooled.Add(200, message);
+        Slice slice = pooled.GetSlice(200);
+        escape(&slice);
+    });
+    bench("stream/Add+GetBytes 64 KB heap", 20000, [&](size_t) {
+        heap.Add(sizeof(message), message);
+        heap.GetBytes(out, sizeof(out));
+        escape(out);
+    });
+    bench("stream/Add+GetBytes 64 KB pooled", 20000, [&](size_t) {
+        pooled.Add(sizeof(message), message);
+        pooled.GetBytes(out, sizeof(out));
+        escape(out);
+    });
+    printf("%-40s %12zu chunks\n", "stream/pooled heap allocations", pool.allocations());
+}
+
+// the union-based SwapEndian stream.h used to have, kept as a baseline
+template <typename T>
+T legacy_swap(T u) {
+    union {
+        T u;
+        unsigned char u8[sizeof(T)];
+    } source, dest;
+    source.u = u;
+    for (size_t k = 0; k < sizeof(T); k++)
+        dest.u8[k] = source.u8[sizeof(T) - k - 1];
+    return dest.u;
+}
+
+// a big-endian feed of 256K uint32_t and 128K double values decoded one
+// at a time through GetBytes and a swap, with the typed reader, and in bulk
+void bench_byte_order() {
+    const size_t kValues = 256 * 1024;
+    std::vector<uint32_t> values(kValues);
+    for (size_t i = 0; i < kValues; i++) {
+        values[i] = static_cast<uint32_t>(i * 2654435761u);
+    }
+    std::vector<uint32_t> out(kValues);
+    Stream stream;
+    stream.PutBE(values.data(), kValues);
+    std::string wire(stream.GetRemaining(), '\0');
+    stream.GetBytes(reinterpret_cast<uint8_t*>(&wire[0]), wire.size());
+
+    auto feed = [&]() { stream.Adopt(&wire[0], wire.size(), [](char*, size_t, void*) {}); };
+    bench("byte order/u32 GetBytes+union swap", 100, [&](size_t) {
+        feed();
+        for (size_t i = 0; i < kValues; i++) {
+            uint32_t v = 0;
+            stream.GetBytes(reinterpret_cast<uint8_t*>(&v), sizeof(v));
+            out[i] = legacy_swap(v);
+        }
+        escape(out.data());
+    });
+    bench("byte order/u32 GetBE one by one", 100, [&](size_t) {
+        feed();
+        for (size_t i = 0; i < kValues; i++) {
+            stream.GetBE(out[i]);
+        }
+        escape(out.data());
+    });
+    bench("byte order/u32 GetBE array", 100, [&](size_t) {
+        feed();
+        stream.GetBE(out.data(), kValues);
+        escape(out.data());
+    });
+    bench("byte order/u32 scalar bswap loop", 100, [&](size_t) {
+        for (size_t i = 0; i < kValues; i++) {
+            uint32_t v;
+            memcpy(&v, &wire[i * sizeof(v)], sizeof(v));
+            out[i] = __builtin_bswap32(v);
+        }
+        escape(out.data());
+    });
+    bench("byte order/u32 LoadBE array", 100, [&](size_t) {
+        LoadBE(wire.data(), out.data(), kValues);
+        escape(out.data());
+    });
+    std::vector<double> doubles(kValues / 2);
+    bench("byte order/f64 union swap loop", 100, [&](size_t) {
+        for (size_t i = 0; i < doubles.size(); i++) {
+            double v;
+            memcpy(&v, &wire[i * sizeof(v)], sizeof(v));
+            doubles[i] = legacy_swap(v);
+        }
+        escape(doubles.data());
+    });
+    bench("byte order/f64 LoadBE array", 100, [&](size_t) {
+        LoadBE(wire.data(), doubles.data(), doubles.size());
+        escape(doubles.data());
+    });
+}
+
+// a million 16-byte frames arriving in 64 KB reads; prints frames per
+// second, a few frames per read straddle two buffers and get copied
+void bench_framing(const char* name, FrameHeader header) {
+    const size_t kFrames = 1000000;
+    const size_t kRead = 64 * 1024;
+    std::string wire;
+    uint8_t prefix[kMaxFrameHeader];
+    for (size_t i = 0; i < kFrames; i++) {
+        wire.append(reinterpret_cast<char*>(prefix), EncodeFrameHeader(header, 16, prefix));
+        wire.append(16, static_cast<char>('a' + i % 26));
+    }
+
+    FrameOptions options;
+    options.header = header;
+    Handler handler(options);
+    size_t frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < wire.size(); pos += kRead) {
+        size_t len = wire.size() - pos < kRead ? wire.size() - pos : kRead;
+        handler.stream.Adopt(&wire[pos], len, [](char*, size_t, void*) {});
+        handler.ParseBuffers([&frames](const Slice& frame) {
+            frames += frame.size() == 16;
+        });
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%-40s %12.2f M frames/s (%zu frames)\n", name, frames / seconds / 1e6, frames);
+}
+
+void bench_framings() {
+    bench_framing("frames/u8", FrameHeader::kU8);
+    bench_framing("frames/u32 big-endian", FrameHeader::kU32BE);
+    bench_framing("frames/varint", FrameHeader::kVarint);
+}
+
+// a million 9-byte frames (opcode + 8-byte value) routed to a handler
+// that sums the values, one call per frame or one per run of frames
+void bench_dispatch(const char* name, bool batched) {
+    const size_t kFrames = 1000000;
+    std::string wire;
+    for (size_t i = 0; i < kFrames; i++) {
+        uint64_t value = i;
+        wire.push_back(9);
+        wire.push_back(1);
+        wire.append(reinterpret_cast<char*>(&value), sizeof(value));
+    }
+
+    Handler handler;
+    uint64_t sum = 0;
+    if (batched) {
+        handler.dispatcher.OnBatch(1, [](void* ctx, const Frame* frames, size_t count) {
+            uint64_t total = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint64_t value;
+                memcpy(&value, frames[i].body.data(), sizeof(value));
+                total += value;
+            }
+            *static_cast<uint64_t*>(ctx) += total;
+        }, &sum);
+    } else {
+        handler.dispatcher.On(1, [](void* ctx, const Frame& frame) {
+            uint64_t value;
+            memcpy(&value, frame.body.data(), sizeof(value));
+            *static_cast<uint64_t*>(ctx) += value;
+        }, &sum);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; pos < wire.size(); pos += 64 * 1024) {
+        size_t len = wire.size() - pos < 64 * 1024 ? wire.size() - pos : 64 * 1024;
+        handler.stream.Adopt(&wire[pos], len, [](char*, size_t, void*) {});
+        handler.Dispatch();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / kFrames;
+    printf("%-40s %12.2f ns/frame (sum %llu)\n", name, ns, static_cast<unsigned long long>(sum));
+}
+
+void bench_dispatchers() {
+    bench_dispatch("dispatch/per frame", false);
+    bench_dispatch("dispatch/batched", true);
+}
+
+// 16-byte frames written over loopback TCP by a client thread, round
+// robin across the connections, and counted by an edge-triggered loop
+void bench_event_loop(size_t connections) {
+    const size_t kFrames = 2000000;
+    const size_t kBurst = 64;   // frames per write
+    EventLoop loop;
+    int listener = loop.ListenTcp("127.0.0.1", 0);
+    if (!loop || listener < 0) {
+        printf("event loop unavailable: %s\n", strerror(errno));
+        return;
+    }
+    size_t frames = 0;
+    loop.OnOpen([](void* ctx, Connection& conn) {
+        conn.handler.dispatcher.OnBatch(1, [](void* ctx, const Frame*, size_t count) {
+            *static_cast<size_t*>(ctx) += count;
+        }, ctx);
+    }, &frames);
+
+    std::string burst;
+    for (size_t i = 0; i < kBurst; i++) {
+        burst.push_back(15);
+        burst.push_back(1);
+        burst.append(14, 'x');
+    }
+    uint16_t port = EventLoop::LocalPort(listener);
+    std::atomic<bool> connected{false};
+    std::thread client([&] {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::vector<int> fds;
+        for (size_t i = 0; i < connections; i++) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+                abort();
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fds.push_back(fd);
+        }
+        connected.store(true, std::memory_order_release);
+        for (size_t sent = 0; sent < kFrames; sent += kBurst) {
+            if (write(fds[sent / kBurst % connections], burst.data(), burst.size()) != static_cast<ssize_t>(burst.size()))
+                abort();
+        }
+        for (int fd : fds)
+            close(fd);
+    });
+    // the clock starts once every handshake is done, accepting meanwhile
+    while (!connected.load(std::memory_order_acquire) || loop.connections() < connections)
+        loop.RunOnce(1);
+    auto start = std::chrono::steady_clock::now();
+    while (frames < kFrames)
+        loop.RunOnce(100);
+    auto end = std::chrono::steady_clock::now();
+    client.join();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::string name = "event loop/" + std::to_string(connections) + " connections";
+    printf("%-40s %12.2f M frames/s (%zu frames)\n", name.c_str(), frames / seconds / 1e6, frames);
+}
+
+void bench_event_loops() {
+    bench_event_loop(1);
+    bench_event_loop(64);
+    bench_event_loop(512);
+}
+
+// 32-byte replies sent over a Unix socket pair to a thread that reads them
+// away: one write per reply, then queued in an OutputStream and flushed
+// every kBatch replies, copied or by reference
+template <typename F>
+void bench_replies(const char* name, F&& send) {
+    const size_t kReplies = 1000000;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        abort();
+    const size_t total = kReplies * 33;
+    std::thread reader([&] {
+        static char buf[256 * 1024];
+        size_t read_bytes = 0;
+        while (read_bytes < total) {
+            ssize_t n = read(fds[1], buf, sizeof(buf));
+            if (n <= 0)
+                abort();
+            read_bytes += n;
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    send(fds[0], kReplies);
+    reader.join();
+    auto end = std::chrono::steady_clock::now();
+    close(fds[0]);
+    close(fds[1]);
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%-40s %12.2f M replies/s\n", name, kReplies / seconds / 1e6);
+}
+
+void bench_output_stream() {
+    const size_t kBatch = 64;
+    static char reply[33] = {32, 1};
+    bench_replies("output/write per reply", [](int fd, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (write(fd, reply, sizeof(reply)) != static_cast<ssize_t>(sizeof(reply)))
+                abort();
+        }
+    });
+    bench_replies("output/OutputStream copy", [&](int fd, size_t count) {
+        OutputStream out;
+        for (size_t i = 0; i < count; i++) {
+            out.WriteFrame(FrameHeader::kU8, reply + 1, sizeof(reply) - 1);
+            if ((i + 1) % kBatch == 0 && !out.Flush(fd))
+                abort();
+        }
+        out.Flush(fd);
+    });
+    bench_replies("output/OutputStream by reference", [&](int fd, size_t count) {
+        BufferPool pool;
+        Stream payloads(&pool);
+        payloads.Add(sizeof(reply) - 1, reply + 1);
+        Slice payload = payloads.GetSlice(sizeof(reply) - 1);
+        OutputStream out(OutputOptions(), &pool);
+        for (size_t i = 0; i < count; i++) {
+            out.WriteFrame(FrameHeader::kU8, payload);
+            if ((i + 1) % kBatch == 0 && !out.Flush(fd))
+                abort();
+        }
+        out.Flush(fd);
+    });
+}
+
+// 20000 1 KB frames echoed by the loop to a peer that sends them all, then
+// shuts down its write side and reads until EOF; every reply must arrive
+void bench_half_close_echo() {
+    const size_t kFrames = 20000;
+    FrameOptions frames;
+    frames.header = FrameHeader::kU16BE;
+    LoopOptions options;
+    options.frames = frames;
+    EventLoop loop(options);
+    loop.OnOpen([](void*, Connection& conn) {
+        conn.handler.dispatcher.On(1, [](void* ctx, const Frame& frame) {
+            static_cast<Connection*>(ctx)->output.WriteFrame(FrameHeader::kU16BE, frame.Retain());
+        }, &conn);
+    });
+    int fds[2];
+    if (!loop || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !loop.Add(fds[0]))
+        abort();
+    std::string frame(2 + 1024, 'x');
+    frame[0] = 1024 >> 8;
+    frame[1] = 0;
+    frame[2] = 1;
+    size_t received = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread reader([&] {
+        static char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(fds[1], buf, sizeof(buf))) > 0)
+            received += n;
+        loop.Stop();
+    });
+    std::thread writer([&] {
+        for (size_t i = 0; i < kFrames; i++) {
+            if (write(fds[1], frame.data(), frame.size()) != static_cast<ssize_t>(frame.size()))
+                abort();
+        }
+        shutdown(fds[1], SHUT_WR);
+    });
+    loop.Run();
+    writer.join();
+    reader.join();
+    auto end = std::chrono::steady_clock::now();
+    close(fds[1]);
+    if (received != kFrames * frame.size()) {
+        printf("half-closed echo lost replies: %zu of %zu bytes\n", received, kFrames * frame.size());
+        abort();
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%-40s %12.2f MB/s\n", "output/half-closed echo 1 KB", received / seconds / 1e6);
+}
+
+struct BenchOrder {
+    uint64_t id = 0;
+    int32_t quantity = 0;
+    int64_t price_ticks = 0;
+    std::string symbol;
+    std::vector<uint32_t> fills;
+};
+
+namespace utils {
+template <>
+struct Schema<BenchOrder> {
+    template <typename Visitor, typename O>
+    static void fields(Visitor& v, O& o) {
+        v.field(1, o.id);
+        v.field(2, o.quantity);
+        v.field(3, Fixed(o.price_ticks));
+        v.field(4, o.symbol);
+        v.field(5, o.fills);
+    }
+};
+}
+
+// an order with four fills written as text with utils::string_format and
+// through the binary schema into a reused buffer, then decoded back
+void bench_serialize() {
+    BenchOrder order;
+    order.id = 1234567890123ull;
+    order.quantity = -250;
+    order.price_ticks = 1873250;
+    order.symbol = "MSFT";
+    order.fills = {100, 50, 75, 25};
+
+    size_t bytes = 0;
+    bench("serialize/string_format", 1000000, [&](size_t) {
+        std::string text = utils::string_format("%llu|%d|%lld|%s|%u,%u,%u,%u",
+                static_cast<unsigned long long>(order.id), order.quantity,
+                static_cast<long long>(order.price_ticks), order.symbol.c_str(),
+                order.fills[0], order.fills[1], order.fills[2], order.fills[3]);
+        bytes = text.size();
+        escape(&text);
+    });
+    printf("%-40s %12zu bytes\n", "", bytes);
+    utils::OutputBuffer out;
+    bench("serialize/Encode", 1000000, [&](size_t) {
+        out.clear();
+        utils::Encode(order, out);
+        escape(out.data());
+    });
+    printf("%-40s %12zu bytes\n", "", out.size());
+    BenchOrder decoded;
+    bench("serialize/Decode", 1000000, [&](size_t) {
+        decoded.fills.clear();
+        utils::Decode(out.view(), decoded);
+        escape(&decoded);
+    });
+}
+
+// producers hand kItems values each to one consumer, batch at a time;
+// push and pop return how many items they moved, 0 when full or empty
+template <typename Push, typename Pop>
+void bench_pipeline(const char* name, size_t producers, size_t batch, Push push, Pop pop) {
+    const size_t kItems = 2000000;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < producers; t++) {
+        threads.emplace_back([&, t] {
+            std::vector<uint64_t> items(batch);
+            for (size_t i = 0; i < kItems; i += batch) {
+                for (size_t k = 0; k < batch; k++) {
+                    items[k] = t * kItems + i + k;
+                }
+                for (size_t done = 0; done < batch;) {
+                    size_t n = push(items.data() + done, batch - done);
+                    if (n == 0) {
+                        std::this_thread::yield();
+                    }
+                    done += n;
+                }
+            }
+        });
+    }
+    std::vector<uint64_t> out(batch);
+    uint64_t sum = 0;
+    for (size_t got = 0; got < producers * kItems;) {
+        size_t n = pop(out.data(), batch);
+        if (n == 0) {
+            std::this_thread::yield();
+        }
+        for (size_t k = 0; k < n; k++) {
+            sum += out[k];
+        }
+        got += n;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    escape(&sum);
+    printf("%-40s %12.2f ns/item\n", name,
+           std::chrono::duration<double, std::nano>(end - start).count() / (producers * kItems));
+}
+
+void bench_queues() {
+    std::mutex mutex;
+    std::deque<uint64_t> locked;
+    auto locked_push = [&](uint64_t* items, size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (locked.size() >= 4096) {
+            return size_t(0);
+        }
+        locked.insert(locked.end(), items, items + n);
+        return n;
+    };
+    auto locked_pop = [&](uint64_t* out, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = locked.size() < max ? locked.size() : max;
+        std::copy(locked.begin(), locked.begin() + n, out);
+        locked.erase(locked.begin(), locked.begin() + n);
+        return n;
+    };
+    utils::SpscQueue<uint64_t> spsc(4096);
+    auto spsc_push = [&](uint64_t* items, size_t n) {
+        return n == 1 ? size_t(spsc.push(*items)) : spsc.push_batch(items, n);
+    };
+    auto spsc_pop = [&](uint64_t* out, size_t max) {
+        return max == 1 ? size_t(spsc.pop(*out)) : spsc.pop_batch(out, max);
+    };
+    utils::MpscQueue<uint64_t> mpsc(4096);
+    auto mpsc_push = [&](uint64_t* items, size_t n) {
+        return n == 1 ? size_t(mpsc.push(*items)) : mpsc.push_batch(items, n);
+    };
+    auto mpsc_pop = [&](uint64_t* out, size_t max) {
+        return max == 1 ? size_t(mpsc.pop(*out)) : mpsc.pop_batch(out, max);
+    };
+
+    bench_pipeline("queue/1:1 mutex+deque", 1, 1, locked_push, locked_pop);
+    bench_pipeline("queue/1:1 SpscQueue", 1, 1, spsc_push, spsc_pop);
+    bench_pipeline("queue/1:1 mutex+deque batch 64", 1, 64, locked_push, locked_pop);
+    bench_pipeline("queue/1:1 SpscQueue batch 64", 1, 64, spsc_push, spsc_pop);
+    bench_pipeline("queue/4:1 mutex+deque", 4, 1, locked_push, locked_pop);
+    bench_pipeline("queue/4:1 MpscQueue", 4, 1, mpsc_push, mpsc_pop);
+    bench_pipeline("queue/4:1 mutex+deque batch 64", 4, 64, locked_push, locked_pop);
+    bench_pipeline("queue/4:1 MpscQueue batch 64", 4, 64, mpsc_push, mpsc_pop);
+}
+
+int main() {
+    bench_string_view_find();
+    bench_multi_matcher();
+    bench_string_hash();
+    bench_memory_pool();
+    bench_slab_backings();
+    bench_concurrent_pool();
+    bench_pool_allocator();
+    bench_arena();
+    bench_object_pool();
+    bench_scope_guard();
+    bench_epoch();
+    bench_stream();
+    bench_stream_zero_copy();
+    bench_buffer_pool();
+    bench_byte_order();
+    bench_framings();
+    bench_dispatchers();
+    bench_event_loops();
+    bench_output_stream();
+    bench_half_close_echo();
+    bench_queues();
+    bench_serialize();
+    return 0;
+}
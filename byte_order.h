@@ -0,0 +1,210 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+inline bool IsBigEndianHost() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline uint8_t ByteSwap(uint8_t v) {
+    return v;
+}
+
+inline uint16_t ByteSwap(uint16_t v) {
+    return __builtin_bswap16(v);
+}
+
+inline uint32_t ByteSwap(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+
+inline uint64_t ByteSwap(uint64_t v) {
+    return __builtin_bswap64(v);
+}
+
+template <size_t N>
+struct UnsignedOfSize;
+
+template <>
+struct UnsignedOfSize<1> {
+    typedef uint8_t type;
+};
+
+template <>
+struct UnsignedOfSize<2> {
+    typedef uint16_t type;
+};
+
+template <>
+struct UnsignedOfSize<4> {
+    typedef uint32_t type;
+};
+
+template <>
+struct UnsignedOfSize<8> {
+    typedef uint64_t type;
+};
+
+// reverses the bytes of an integer, float or double
+template <typename T>
+T SwapEndian(T u) {
+    typename UnsignedOfSize<sizeof(T)>::type bits;
+    memcpy(&bits, &u, sizeof(u));
+    bits = ByteSwap(bits);
+    memcpy(&u, &bits, sizeof(u));
+    return u;
+}
+
+// unaligned loads and stores in a fixed byte order
+template <typename T>
+T LoadBE(const void *p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return IsBigEndianHost() ? v : SwapEndian(v);
+}
+
+template <typename T>
+T LoadLE(const void *p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return IsBigEndianHost() ? SwapEndian(v) : v;
+}
+
+template <typename T>
+void StoreBE(void *p, T v) {
+    if (!IsBigEndianHost())
+        v = SwapEndian(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+template <typename T>
+void StoreLE(void *p, T v) {
+    if (IsBigEndianHost())
+        v = SwapEndian(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+namespace byte_order {
+// shuffle masks reversing each 2, 4 or 8 byte lane of 16 bytes
+#if defined(__AVX2__) || defined(__SSSE3__)
+template <size_t Width>
+inline __m128i ReverseMask() {
+    char m[16];
+    for (size_t i = 0; i < 16; i++)
+        m[i] = static_cast<char>(i - i % Width + Width - 1 - i % Width);
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(m));
+}
+#endif
+
+#if defined(__SSE2__) && !defined(__SSSE3__) && !defined(__AVX2__)
+template <size_t Width>
+inline __m128i Reverse(__m128i x);
+
+template <>
+inline __m128i Reverse<1>(__m128i x) {
+    return x;
+}
+
+template <>
+inline __m128i Reverse<2>(__m128i x) {
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+template <>
+inline __m128i Reverse<4>(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return Reverse<2>(x);
+}
+
+template <>
+inline __m128i Reverse<8>(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+    x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+    return Reverse<2>(x);
+}
+#endif
+}
+
+// Byte-swaps count elements of Width bytes from src to dst. Neither needs
+// to be aligned and they may be the same array, but must not otherwise
+// overlap. Runs 32 bytes at a time with AVX2, 16 with SSSE3 or SSE2.
+template <size_t Width>
+void SwapBytes(const void *src, void *dst, size_t count) {
+    typedef typename UnsignedOfSize<Width>::type Unsigned;
+    const char *s = static_cast<const char *>(src);
+    char *d = static_cast<char *>(dst);
+    size_t bytes = count * Width;
+    size_t i = 0;
+    if (Width > 1) {
+#if defined(__AVX2__)
+        const __m128i lane = byte_order::ReverseMask<Width>();
+        const __m256i mask = _mm256_broadcastsi128_si256(lane);
+        for (; i + 32 <= bytes; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), _mm256_shuffle_epi8(x, mask));
+        }
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), _mm_shuffle_epi8(x, lane));
+        }
+#elif defined(__SSSE3__)
+        const __m128i mask = byte_order::ReverseMask<Width>();
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), _mm_shuffle_epi8(x, mask));
+        }
+#elif defined(__SSE2__)
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), byte_order::Reverse<Width>(x));
+        }
+#endif
+    }
+    for (; i < bytes; i += Width) {
+        Unsigned v;
+        memcpy(&v, s + i, Width);
+        v = ByteSwap(v);
+        memcpy(d + i, &v, Width);
+    }
+}
+
+// converts count values between host order and the other byte order
+template <typename T>
+void SwapEndianArray(const T *src, T *dst, size_t count) {
+    SwapBytes<sizeof(T)>(src, dst, count);
+}
+
+// decodes count big- or little-endian values from unaligned bytes
+template <typename T>
+void LoadBE(const void *src, T *dst, size_t count) {
+    if (IsBigEndianHost() && count)
+        memmove(dst, src, count * sizeof(T));
+    else if (!IsBigEndianHost())
+        SwapBytes<sizeof(T)>(src, dst, count);
+}
+
+template <typename T>
+void LoadLE(const void *src, T *dst, size_t count) {
+    if (IsBigEndianHost())
+        SwapBytes<sizeof(T)>(src, dst, count);
+    else if (count)
+        memmove(dst, src, count * sizeof(T));
+}
+
+#endif // BYTE_ORDER_H
@@ -8,13 +8,15 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <type_traits>
 #include <unordered_map>
 
 #include "utils.h"
+#include "string_map.h"
 
 struct Line
 {
-    Line(const std::unordered_map<std::string, size_t> &header2index, const std::string &line) {
+    Line(const utils::StringMap<size_t> &header2index, const std::string &line) {
         array_ = std::move(utils::split(line));
         header2index_ = header2index;
         convert();
@@ -55,22 +57,51 @@ struct Line
     }
 
     std::string operator[](std::string &&field) const {
+        return (*this)[StringView(field)];
+    }
+
+    // a literal hashes at compile time; a char array is read up to its
+    // first NUL
+    template <size_t N>
+    std::string operator[](const char (&field)[N]) const {
+        return (*this)[utils::ArrayKey(field)];
+    }
+
+    // a char pointer, measured with strlen and hashed at runtime; 0 still
+    // picks the index overload
+    template <typename T, typename std::enable_if<std::is_same<T, const char *>::value ||
+                                                  std::is_same<T, char *>::value, int>::type = 0>
+    std::string operator[](T field) const {
+        return (*this)[StringView(field)];
+    }
+
+    std::string operator[](StringView field) const {
+        return (*this)[utils::HashedKey(field, utils::Hash64(field.data(), field.size()))];
+    }
+
+    std::string operator[](const utils::HashedKey &field) const {
         auto find = header2index_.find(field);
         if (find == header2index_.end()) {
             return std::string();
         }
+        return (*this)[find->second];
+    }
 
-        auto index = find->second;
-        if (index < fields()) {
-            return array_[index];
-        }
-        return std::string();
+    std::string operator[](utils::FieldHandle &field) const {
+        return (*this)[field.resolve(header2index_)];
     }
 
     size_t fields() const {
         return array_.size();
     }
 
+    // empties the line but keeps its buffers, e.g. for ObjectPool recycling
+    void clear() {
+        array_.clear();
+        header2index_.clear();
+        index2header_.clear();
+    }
+
     void convert() {
         for (auto iter = header2index_.begin(); iter != header2index_.end(); iter++) {
             index2header_[iter->second] = iter->first;
@@ -95,7 +126,7 @@ struct Line
     }
 
     std::vector<std::string> array_;
-    std::unordered_map<std::string, size_t> header2index_;
+    utils::StringMap<size_t> header2index_;
     std::unordered_map<size_t, std::string> index2header_;
 };
 
@@ -187,6 +218,14 @@ public:
     }
 
     size_t GetIndex(const std::string &field) const {
+        return GetIndex(StringView(field));
+    }
+
+    size_t GetIndex(StringView field) const {
+        return GetIndex(utils::HashedKey(field, utils::Hash64(field.data(), field.size())));
+    }
+
+    size_t GetIndex(const utils::HashedKey &field) const {
         auto find = header2index_.find(field);
         if (find != header2index_.end()) {
             return find->second;
@@ -263,8 +302,8 @@ private:
     Line header_;
     std::vector<Line> context_;
     std::vector<std::string> key_;
-    std::unordered_map<std::string, size_t> index_;
-    std::unordered_map<std::string, size_t> header2index_;
+    utils::StringMap<size_t> index_;
+    utils::StringMap<size_t> header2index_;
 };
 
 #endif //CSVPARSER_H
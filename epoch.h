@@ -0,0 +1,289 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "finalizer.h"
+
+namespace utils {
+// Epoch based deferred reclamation. Readers of a lock-free structure pin
+// the domain while they hold pointers into it; a writer that unlinks a node
+// retires it instead of freeing it. The global epoch advances once every
+// pinned thread has seen the current one, and a node retired in epoch e
+// is finalized once the epoch reaches e + 2, when no reader can still see
+// it. Finalizers run in batches on the retiring thread.
+class EpochDomain {
+    struct Record;
+
+public:
+    // retired nodes a thread collects before trying to reclaim
+    static constexpr size_t kBatchSize = 64;
+
+    EpochDomain() : state_(std::make_shared<State>()) {}
+
+    // runs every pending finalizer, no thread may be pinned or retiring
+    ~EpochDomain() {
+        state_->closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        for (Record* rec = state_->records.load(std::memory_order_acquire); rec; rec = rec->next) {
+            Run(rec->retired, rec->retired.size());
+        }
+        Run(state_->orphans, state_->orphans.size());
+    }
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // read-side critical section, guards nest
+    class Guard {
+    public:
+        explicit Guard(EpochDomain& domain) : domain_(&domain), rec_(&domain.record()) {
+            domain_->enter(*rec_);
+        }
+
+        Guard(Guard&& other) : domain_(other.domain_), rec_(other.rec_) {
+            other.rec_ = nullptr;
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            if (rec_) {
+                domain_->leave(*rec_);
+            }
+        }
+
+    private:
+        EpochDomain* domain_;
+        Record* rec_;
+    };
+
+    Guard pin() {
+        return Guard(*this);
+    }
+
+    // fn(arg, ctx) runs once no pinned thread can still reach arg
+    void retire(void* arg, void (*fn)(void*, void*), void* ctx = nullptr) {
+        Record& rec = record();
+        rec.retired.push_back(Retired{fn, arg, ctx, state_->epoch.load(std::memory_order_seq_cst)});
+        if (rec.retired.size() >= kBatchSize) {
+            collect(rec);
+        }
+    }
+
+    template <typename T>
+    void retire(T* p) {
+        void (*fn)(void*, void*) = [](void* arg, void*) { delete static_cast<T*>(arg); };
+        retire(static_cast<void*>(p), fn);
+    }
+
+    // hands p back to pool.free_node, the pool must be thread-safe
+    template <typename T, typename Pool>
+    void retire_node(T* p, Pool& pool) {
+        void (*fn)(void*, void*) = [](void* arg, void* ctx) {
+            static_cast<Pool*>(ctx)->free_node(static_cast<T*>(arg));
+        };
+        retire(static_cast<void*>(p), fn, &pool);
+    }
+
+    // tries to advance the epoch and finalizes what the calling thread
+    // retired that is now safe
+    void reclaim() {
+        collect(record());
+    }
+
+    // finalizes everything the calling thread retired, spinning until the
+    // other pinned threads move on; must not be called while pinned
+    void drain() {
+        Record& rec = record();
+        while (!rec.retired.empty()) {
+            collect(rec);
+        }
+    }
+
+    uint64_t epoch() const {
+        return state_->epoch.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint64_t kIdle = UINT64_MAX;
+
+    struct Retired {
+        void (*fn)(void*, void*);
+        void* arg;
+        void* ctx;
+        uint64_t epoch;
+    };
+
+    // per-thread state, linked into the domain and reused after the
+    // thread exits
+    struct Record {
+        std::atomic<uint64_t> epoch{kIdle};
+        std::atomic<bool> in_use{true};
+        size_t nesting = 0;
+        std::vector<Retired> retired;
+        Record* next = nullptr;
+    };
+
+    struct State {
+        ~State() {
+            Record* rec = records.load(std::memory_order_relaxed);
+            while (rec) {
+                Record* next = rec->next;
+                delete rec;
+                rec = next;
+            }
+        }
+
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<Record*> records{nullptr};
+        std::atomic<bool> closed{false};
+        std::mutex mutex;
+        std::vector<Retired> orphans;   // left behind by exited threads
+    };
+
+    struct LocalRecords {
+        struct Entry {
+            std::shared_ptr<State> state;
+            Record* rec;
+        };
+
+        ~LocalRecords() {
+            for (auto& entry : entries) {
+                Release(entry);
+            }
+        }
+
+        std::vector<Entry> entries;
+        const State* last_state = nullptr;
+        Record* last = nullptr;
+    };
+
+    static void Run(std::vector<Retired>& retired, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            retired[i].fn(retired[i].arg, retired[i].ctx);
+        }
+        retired.erase(retired.begin(), retired.begin() + n);
+    }
+
+    static void Release(LocalRecords::Entry& entry) {
+        std::lock_guard<std::mutex> lock(entry.state->mutex);
+        if (!entry.state->closed.load(std::memory_order_acquire)) {
+            auto& retired = entry.rec->retired;
+            entry.state->orphans.insert(entry.state->orphans.end(), retired.begin(), retired.end());
+        }
+        entry.rec->retired.clear();
+        entry.rec->in_use.store(false, std::memory_order_release);
+    }
+
+    static LocalRecords& local() {
+        static thread_local LocalRecords records;
+        return records;
+    }
+
+    void enter(Record& rec) {
+        if (rec.nesting++ == 0) {
+            // the fence orders the announcement before any read of the
+            // structure, pairing with the fence in try_advance
+            rec.epoch.store(state_->epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void leave(Record& rec) {
+        if (--rec.nesting == 0) {
+            rec.epoch.store(kIdle, std::memory_order_release);
+        }
+    }
+
+    bool try_advance() {
+        uint64_t epoch = state_->epoch.load(std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (Record* rec = state_->records.load(std::memory_order_acquire); rec; rec = rec->next) {
+            uint64_t seen = rec->epoch.load(std::memory_order_acquire);
+            if (seen != kIdle && seen != epoch) {
+                return false;
+            }
+        }
+        return state_->epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    }
+
+    void collect(Record& rec) {
+        try_advance();
+        uint64_t epoch = state_->epoch.load(std::memory_order_seq_cst);
+        // retired in epoch order, so the safe ones form a prefix
+        size_t n = 0;
+        while (n < rec.retired.size() && rec.retired[n].epoch + 2 <= epoch) {
+            n++;
+        }
+        Run(rec.retired, n);
+
+        std::unique_lock<std::mutex> lock(state_->mutex, std::try_to_lock);
+        if (lock && !state_->orphans.empty()) {
+            auto& orphans = state_->orphans;
+            n = 0;
+            while (n < orphans.size() && orphans[n].epoch + 2 <= epoch) {
+                n++;
+            }
+            std::vector<Retired> ready(orphans.begin(), orphans.begin() + n);
+            orphans.erase(orphans.begin(), orphans.begin() + n);
+            lock.unlock();
+            Run(ready, ready.size());
+        }
+    }
+
+    Record& record() {
+        LocalRecords& local = EpochDomain::local();
+        if (local.last_state == state_.get()) {
+            return *local.last;
+        }
+
+        Record* found = nullptr;
+        auto& entries = local.entries;
+        for (size_t i = 0; i < entries.size();) {
+            if (entries[i].state->closed.load(std::memory_order_acquire)) {
+                entries[i] = std::move(entries.back());
+                entries.pop_back();
+                continue;
+            }
+            if (entries[i].state == state_) {
+                found = entries[i].rec;
+            }
+            i++;
+        }
+        if (!found) {
+            found = acquire_record();
+            entries.push_back(LocalRecords::Entry{state_, found});
+        }
+        local.last_state = state_.get();
+        local.last = found;
+        return *found;
+    }
+
+    // reuses the record of an exited thread or links a new one
+    Record* acquire_record() {
+        for (Record* rec = state_->records.load(std::memory_order_acquire); rec; rec = rec->next) {
+            bool free = false;
+            if (!rec->in_use.load(std::memory_order_relaxed) &&
+                rec->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                return rec;
+            }
+        }
+        Record* rec = new Record();
+        rec->next = state_->records.load(std::memory_order_relaxed);
+        while (!state_->records.compare_exchange_weak(rec->next, rec, std::memory_order_release,
+                                                      std::memory_order_relaxed)) {
+        }
+        return rec;
+    }
+
+    std::shared_ptr<State> state_;
+};
+}
+
+#endif // EPOCH_H
@@ -0,0 +1,444 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "output_stream.h"
+#include "stream.h"
+
+struct LoopOptions {
+    FrameOptions frames;
+    OutputOptions output;
+    size_t chunk_size = 64 * 1024;  // stream chunk readv fills
+    size_t max_idle_chunks = 256;   // chunks kept for reuse across connections
+    int max_events = 256;           // events taken per epoll_wait
+};
+
+class EventLoop;
+
+// A socket watched by the loop, its input stream and frame handler, and
+// its output queue. Routes are registered on handler.dispatcher, usually
+// from OnOpen; replies written to output during a dispatch are flushed
+// when the reads of that round are done.
+class Connection {
+public:
+    Connection(EventLoop *loop, int fd, const LoopOptions &options, BufferPool *pool)
+        : handler(options.frames, pool), output(options.output, pool), loop_(loop), fd_(fd) {}
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    int fd() const {
+        return fd_;
+    }
+
+    // closes the connection once the loop is done with the current events,
+    // after one last attempt to write what output holds
+    void Close();
+
+    // flushes output at the end of the current round, for writes made
+    // outside this connection's own dispatch
+    void Flush();
+
+    bool closing() const {
+        return closing_;
+    }
+
+    Handler handler;
+    OutputStream output;
+    void *user = nullptr;   // free for the owner
+
+private:
+    friend class EventLoop;
+
+    EventLoop *loop_;
+    int fd_;
+    bool closing_ = false;
+    bool flushing_ = false;     // queued in EventLoop::flushing_
+    bool hangup_ = false;       // the peer shut down its side
+    bool eof_ = false;          // input read to its end, closed once output drains
+    bool read_paused_ = false;  // input left unread while output is over its high watermark
+    size_t index_ = 0;      // position in EventLoop::connections_
+};
+
+typedef void (*ConnectionFn)(void *ctx, Connection &conn);
+
+// Edge-triggered epoll loop over non-blocking TCP and Unix-domain sockets.
+// Readable connections are drained with readv straight into the free chunk
+// space of their Stream, drawn from a pool shared by all connections, and
+// every complete frame is dispatched after each read. Slices retained from
+// frames must not outlive the loop. Output is flushed with batched writev
+// once per round and again whenever the socket turns writable. While a
+// connection's output is over its high watermark its input is left unread,
+// so a peer that does not read cannot make the loop queue without bound;
+// reading resumes, after OnDrain, once output falls to the low watermark.
+// A connection is closed once the peer's input is read to its end and
+// the replies queued for it are written, on a read or write error and on a
+// frame the reader rejects. Everything but Stop must be called from the
+// loop's thread.
+class EventLoop {
+public:
+    explicit EventLoop(const LoopOptions &options = LoopOptions())
+        : options_(options), pool_(options.chunk_size, options.max_idle_chunks), events_(options.max_events) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ >= 0 && wake_fd_ >= 0)
+            Watch(wake_fd_, &wake_, EPOLLIN);
+    }
+
+    ~EventLoop() {
+        for (auto &conn : connections_)
+            close(conn->fd_);
+        for (auto &listener : listeners_)
+            close(listener.fd);
+        if (wake_fd_ >= 0)
+            close(wake_fd_);
+        if (epoll_fd_ >= 0)
+            close(epoll_fd_);
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    explicit operator bool() const {
+        return epoll_fd_ >= 0 && wake_fd_ >= 0;
+    }
+
+    // runs for every new connection before its first read
+    void OnOpen(ConnectionFn fn, void *ctx = nullptr) {
+        on_open_ = fn;
+        on_open_ctx_ = ctx;
+    }
+
+    // runs before a connection is closed and freed
+    void OnClose(ConnectionFn fn, void *ctx = nullptr) {
+        on_close_ = fn;
+        on_close_ctx_ = ctx;
+    }
+
+    // runs when a connection's output falls back to its low watermark
+    // after passing the high one
+    void OnDrain(ConnectionFn fn, void *ctx = nullptr) {
+        on_drain_ = fn;
+        on_drain_ctx_ = ctx;
+    }
+
+    // listens on host:port, port 0 picks a free one; returns the socket or
+    // -1 with errno set
+    int ListenTcp(const char *host, uint16_t port, int backlog = SOMAXCONN) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+        return Listen(AF_INET, reinterpret_cast<sockaddr *>(&addr), sizeof(addr), backlog);
+    }
+
+    int ListenUnix(const char *path, int backlog = SOMAXCONN) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+        return Listen(AF_UNIX, reinterpret_cast<sockaddr *>(&addr), sizeof(addr), backlog);
+    }
+
+    // the port a TCP socket is bound to, 0 on error
+    static uint16_t LocalPort(int fd) {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+            return 0;
+        return ntohs(addr.sin_port);
+    }
+
+    // watches an already connected socket, the loop takes ownership of fd;
+    // nullptr with errno set on failure
+    Connection *Add(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            close(fd);
+            return nullptr;
+        }
+        std::unique_ptr<Connection> conn(new Connection(this, fd, options_, &pool_));
+        if (!Watch(fd, conn.get(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+            close(fd);
+            return nullptr;
+        }
+        conn->index_ = connections_.size();
+        connections_.push_back(std::move(conn));
+        // epoll reports data that arrived before the socket was watched
+        Connection *p = connections_.back().get();
+        if (on_open_)
+            on_open_(on_open_ctx_, *p);
+        return p;
+    }
+
+    // waits up to timeout_ms for events and handles them, returns the
+    // number of events or -1 with errno set
+    int RunOnce(int timeout_ms) {
+        int n = epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), timeout_ms);
+        if (n < 0)
+            return errno == EINTR ? 0 : -1;
+        for (int i = 0; i < n; i++) {
+            void *source = events_[i].data.ptr;
+            if (source == &wake_) {
+                uint64_t count;
+                while (read(wake_fd_, &count, sizeof(count)) > 0) {
+                }
+                stopped_ = true;
+            } else if (!listeners_.empty() && source >= static_cast<void *>(&listeners_.front()) &&
+                       source <= static_cast<void *>(&listeners_.back())) {
+                Accept(*static_cast<Listener *>(source));
+            } else {
+                Connection &conn = *static_cast<Connection *>(source);
+                uint32_t events = events_[i].events;
+                if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    conn.hangup_ = true;
+                if (!conn.closing_ && (events & EPOLLOUT))
+                    Write(conn);
+                if (!conn.closing_ && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    Read(conn);
+            }
+        }
+        // replies written during the round go out in one batch per connection
+        for (size_t i = 0; i < flushing_.size(); i++) {
+            Connection &conn = *flushing_[i];
+            conn.flushing_ = false;
+            if (!conn.closing_)
+                Write(conn);
+        }
+        flushing_.clear();
+        Reap();
+        return n;
+    }
+
+    // handles events until Stop is called
+    void Run() {
+        stopped_ = false;
+        while (!stopped_) {
+            if (RunOnce(-1) < 0)
+                break;
+        }
+    }
+
+    // makes Run return, may be called from any thread
+    void Stop() {
+        uint64_t one = 1;
+        ssize_t n = write(wake_fd_, &one, sizeof(one));
+        (void)n;
+    }
+
+    size_t connections() const {
+        return connections_.size();
+    }
+
+private:
+    friend class Connection;
+
+    struct Listener {
+        int fd;
+        bool tcp;
+    };
+
+    // fixed capacity, epoll holds pointers to the entries
+    static constexpr size_t kMaxListeners = 16;
+
+    bool Watch(int fd, void *source, uint32_t events) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = source;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    int Listen(int family, const sockaddr *addr, socklen_t len, int backlog) {
+        if (listeners_.capacity() == 0)
+            listeners_.reserve(kMaxListeners);
+        if (listeners_.size() == kMaxListeners) {
+            errno = EMFILE;
+            return -1;
+        }
+        int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        int one = 1;
+        if (family == AF_INET)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, addr, len) != 0 || listen(fd, backlog) != 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        listeners_.push_back(Listener{fd, family == AF_INET});
+        if (!Watch(fd, &listeners_.back(), EPOLLIN | EPOLLET)) {
+            int saved = errno;
+            listeners_.pop_back();
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        return fd;
+    }
+
+    void Accept(const Listener &listener) {
+        while (true) {
+            int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;     // EAGAIN, or out of descriptors until the next edge
+            }
+            if (listener.tcp) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            Add(fd);
+        }
+    }
+
+    void Read(Connection &conn) {
+        Stream &stream = conn.handler.stream;
+        while (!conn.eof_) {
+            // no later edge comes for data left unread, Write resumes
+            if (!conn.output.Writable()) {
+                conn.read_paused_ = true;
+                return;
+            }
+            Stream::Span spans[2];
+            size_t count = stream.Prepare(spans, options_.chunk_size);
+            iovec iov[2];
+            size_t room = 0;
+            for (size_t i = 0; i < count; i++) {
+                iov[i].iov_base = spans[i].data;
+                iov[i].iov_len = spans[i].size;
+                room += spans[i].size;
+            }
+            ssize_t n = readv(conn.fd_, iov, static_cast<int>(count));
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                bool again = errno == EAGAIN || errno == EWOULDBLOCK;
+                stream.Commit(0);   // gives back the spare chunk
+                if (!again)
+                    Close(conn);
+                return;
+            }
+            if (n == 0) {
+                // a half-closed peer still reads the replies, Write closes
+                conn.eof_ = true;
+                stream.Commit(0);
+                if (conn.output.Empty())
+                    Close(conn);
+                else
+                    QueueFlush(conn);
+                return;
+            }
+            stream.Commit(static_cast<size_t>(n));
+            if (conn.handler.Dispatch() != FrameReader::kNeedMore)
+                Close(conn);
+            if (!conn.output.Empty())
+                QueueFlush(conn);
+            // a short read drained the socket, more data brings a new edge;
+            // after a hangup the stream is read to its end instead
+            if (conn.closing_ || (static_cast<size_t>(n) < room && !conn.hangup_))
+                return;
+        }
+    }
+
+    void Write(Connection &conn) {
+        bool paused = !conn.output.Writable();
+        if (!conn.output.Flush(conn.fd_) || (conn.eof_ && conn.output.Empty())) {
+            Close(conn);
+            return;
+        }
+        if (paused && conn.output.Writable()) {
+            if (on_drain_)
+                on_drain_(on_drain_ctx_, conn);
+            if (conn.read_paused_ && !conn.closing_) {
+                conn.read_paused_ = false;
+                Read(conn);
+            }
+        }
+    }
+
+    void QueueFlush(Connection &conn) {
+        if (!conn.flushing_) {
+            conn.flushing_ = true;
+            flushing_.push_back(&conn);
+        }
+    }
+
+    void Close(Connection &conn) {
+        if (!conn.closing_) {
+            conn.closing_ = true;
+            closing_.push_back(&conn);
+        }
+    }
+
+    // frees the connections closed during the last round
+    void Reap() {
+        for (auto conn : closing_) {
+            if (on_close_)
+                on_close_(on_close_ctx_, *conn);
+            if (!conn->output.Empty())
+                conn->output.Flush(conn->fd_);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd_, nullptr);
+            close(conn->fd_);
+            size_t index = conn->index_;
+            connections_[index] = std::move(connections_.back());
+            connections_[index]->index_ = index;
+            connections_.pop_back();
+        }
+        closing_.clear();
+    }
+
+    LoopOptions options_;
+    BufferPool pool_;           // stream chunks of every connection
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    char wake_ = 0;             // epoll tag of wake_fd_
+    bool stopped_ = false;
+    std::vector<epoll_event> events_;
+    std::vector<Listener> listeners_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<Connection *> closing_;
+    std::vector<Connection *> flushing_;
+    ConnectionFn on_open_ = nullptr;
+    void *on_open_ctx_ = nullptr;
+    ConnectionFn on_close_ = nullptr;
+    void *on_close_ctx_ = nullptr;
+    ConnectionFn on_drain_ = nullptr;
+    void *on_drain_ctx_ = nullptr;
+};
+
+inline void Connection::Close() {
+    loop_->Close(*this);
+}
+
+inline void Connection::Flush() {
+    loop_->QueueFlush(*this);
+}
+
+#endif // EVENT_LOOP_H
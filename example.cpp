@@ -6,6 +6,8 @@
 #include "stream.h"
 #include "version.h"
 #include "string_view.h"
+#include "matcher.h"
+#include "intern.h"
 
 
 void test_csv_parse() {
@@ -21,6 +23,12 @@ void test_csv_parse() {
     result = csv[1][2];
     line = std::move(csv.GetLine({{"id","1"},{"name","xxx"},{"age", "20"}}));
     std::cout << line.str() << std::endl;
+
+    // resolved once, then an array index per line
+    utils::FieldHandle name("name");
+    for (size_t i = 0; i < csv.GetRow(); i++) {
+        std::cout << csv[i][name] << std::endl;
+    }
 }
 
 void test_mysql() {
@@ -49,8 +57,9 @@ void test_mysql() {
     std::cout << str << std::endl;
     sql::Result r = sql.query(str);
     if (!r) return;
+    utils::FieldHandle title("runoob_title");
     while (sql::Row row = r.next()) {
-        std::cout << row["runoob_id"] << " "<< row["runoob_title"] << " " << row["runoob_author"] << " " << row["submission_date"] << std::endl;
+        std::cout << row["runoob_id"] << " "<< row[title] << " " << row["runoob_author"] << " " << row["submission_date"] << std::endl;
     }
 
     sql::Updater updater;
@@ -154,7 +163,9 @@ void test_stream() {
         buff[count + 1] = '\0';
         handler.stream.Add(count + 1, buff);
     }
-    handler.ParseBuffers();
+    handler.ParseBuffers([](const Slice& frame) {
+        std::cout << "command = " << frame.view() << std::endl;
+    });
 }
 
 void test_string_view() {
@@ -163,6 +174,20 @@ void test_string_view() {
 
     auto str = sv.ToString();
     std::cout << str << std::endl;
+
+    StringView text("GET /index.html HTTP/1.1");
+    Searcher searcher(StringView("HTTP/"));
+    std::cout << text.find("index") << " " << searcher.find(text) << std::endl;
+
+    MultiMatcher matcher({"GET", "POST", "index", "HTTP/1.1"});
+    for (const auto& m : matcher.find_all(text)) {
+        std::cout << m.pattern << "@" << m.offset << " ";
+    }
+    std::cout << std::endl;
+
+    utils::StringPool pool;
+    auto id = pool.intern(std::string("runoob_title"));
+    std::cout << (id == pool.intern("runoob_title")) << " " << pool.view(id) << std::endl;
 }
 
 int main(int argc,char** argv) {
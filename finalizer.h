@@ -5,7 +5,10 @@
 #ifndef _FINALIZER_H_
 #define _FINALIZER_H_
 
+#include <exception>
 #include <functional>
+#include <type_traits>
+#include <utility>
 
 class Finalizer {
 public:
@@ -19,4 +22,70 @@ private:
     std::function<void ()> finalizer_;
 };
 
-#endif //_FINALIZER_H_
\ No newline at end of file
+// number of exceptions in flight on this thread; without
+// std::uncaught_exceptions it is only 0 or 1, so a guard created while
+// unwinding cannot tell whether its own scope failed
+inline int UncaughtExceptions() {
+#if defined(__cpp_lib_uncaught_exceptions)
+    return std::uncaught_exceptions();
+#else
+    return std::uncaught_exception() ? 1 : 0;
+#endif
+}
+
+enum class GuardMode {
+    kAlways,
+    kOnFailure,     // only when the scope is left by an exception
+    kOnSuccess,     // only when the scope is left normally
+};
+
+// Runs a callable when the scope ends. The callable is stored inline, so
+// unlike Finalizer there is no allocation and no indirect call; dismiss()
+// turns the guard off, e.g. once a transaction has been committed.
+template <typename F, GuardMode Mode = GuardMode::kAlways>
+class ScopeGuard {
+public:
+    explicit ScopeGuard(F f) : f_(std::move(f)), exceptions_(Mode == GuardMode::kAlways ? 0 : UncaughtExceptions()) {}
+
+    ScopeGuard(ScopeGuard&& other) : f_(std::move(other.f_)), exceptions_(other.exceptions_), active_(other.active_) {
+        other.active_ = false;
+    }
+
+    ScopeGuard(const ScopeGuard&) = delete;
+    ScopeGuard& operator=(const ScopeGuard&) = delete;
+
+    ~ScopeGuard() noexcept(Mode != GuardMode::kOnSuccess) {
+        if (!active_) {
+            return;
+        }
+        if (Mode == GuardMode::kAlways || (UncaughtExceptions() > exceptions_) == (Mode == GuardMode::kOnFailure)) {
+            f_();
+        }
+    }
+
+    void dismiss() {
+        active_ = false;
+    }
+
+private:
+    F f_;
+    int exceptions_;
+    bool active_ = true;
+};
+
+template <typename F>
+ScopeGuard<typename std::decay<F>::type> MakeScopeGuard(F&& f) {
+    return ScopeGuard<typename std::decay<F>::type>(std::forward<F>(f));
+}
+
+template <typename F>
+ScopeGuard<typename std::decay<F>::type, GuardMode::kOnFailure> MakeScopeFail(F&& f) {
+    return ScopeGuard<typename std::decay<F>::type, GuardMode::kOnFailure>(std::forward<F>(f));
+}
+
+template <typename F>
+ScopeGuard<typename std::decay<F>::type, GuardMode::kOnSuccess> MakeScopeSuccess(F&& f) {
+    return ScopeGuard<typename std::decay<F>::type, GuardMode::kOnSuccess>(std::forward<F>(f));
+}
+
+#endif //_FINALIZER_H_
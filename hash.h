@@ -0,0 +1,94 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace utils {
+static constexpr uint64_t kP0 = 0xa0761d6478bd642full;
+static constexpr uint64_t kP1 = 0xe7037ed1a0b428dbull;
+static constexpr uint64_t kP2 = 0x8ebc6af09c88c6e3ull;
+
+// 64x64->128 multiply folded back to 64 bits (wyhash "mum")
+#if defined(__SIZEOF_INT128__)
+constexpr uint64_t Fold(__uint128_t r) {
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+constexpr uint64_t Mix(uint64_t a, uint64_t b) {
+    return Fold(static_cast<__uint128_t>(a) * b);
+}
+#else
+constexpr uint64_t MulHi(uint64_t ll, uint64_t lh, uint64_t hl, uint64_t hh) {
+    return hh + (lh >> 32) + (hl >> 32) +
+           (((ll >> 32) + (lh & 0xffffffffull) + (hl & 0xffffffffull)) >> 32);
+}
+
+constexpr uint64_t Mix(uint64_t a, uint64_t b) {
+    return (a * b) ^ MulHi((a & 0xffffffffull) * (b & 0xffffffffull),
+                           (a & 0xffffffffull) * (b >> 32),
+                           (a >> 32) * (b & 0xffffffffull),
+                           (a >> 32) * (b >> 32));
+}
+#endif
+
+inline uint64_t Read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// reads the 1..7 trailing bytes as a little-endian word
+inline uint64_t ReadTail(const unsigned char* p, size_t len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+// Word-at-a-time 64-bit string hash: one 128-bit multiply per 8 bytes.
+inline uint64_t Hash64(const void* data, size_t len, uint64_t seed = 0) {
+    auto p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ Mix(len ^ kP0, kP1);
+    while (len >= 8) {
+        h = Mix(Read64(p) ^ kP1, h ^ kP2);
+        p += 8;
+        len -= 8;
+    }
+    return Mix(h ^ kP0, ReadTail(p, len) ^ kP2);
+}
+
+// constexpr twin of Hash64 for string literals, yields identical values
+constexpr uint64_t ConstByte(const char* p, size_t n, size_t i) {
+    return i < n ? static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i) : 0;
+}
+
+constexpr uint64_t ConstLoad(const char* p, size_t n) {
+    return ConstByte(p, n, 0) | ConstByte(p, n, 1) | ConstByte(p, n, 2) | ConstByte(p, n, 3) |
+           ConstByte(p, n, 4) | ConstByte(p, n, 5) | ConstByte(p, n, 6) | ConstByte(p, n, 7);
+}
+
+constexpr uint64_t ConstHashWords(const char* p, size_t len, uint64_t h) {
+    return len >= 8 ? ConstHashWords(p + 8, len - 8, Mix(ConstLoad(p, 8) ^ kP1, h ^ kP2))
+                    : Mix(h ^ kP0, ConstLoad(p, len) ^ kP2);
+}
+
+constexpr uint64_t ConstHash64(const char* p, size_t len) {
+    return ConstHashWords(p, len, Mix(len ^ kP0, kP1));
+}
+
+inline uint64_t Hash64(const std::string& str) {
+    return Hash64(str.data(), str.size());
+}
+
+inline uint64_t Hash64(const char* str) {
+    return Hash64(str, strlen(str));
+}
+}
+
+#endif // HASH_H
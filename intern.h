@@ -0,0 +1,173 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "hash.h"
+#include "string_view.h"
+
+namespace utils {
+// Id of an interned string, two symbols from the same pool are equal
+// exactly when their strings are.
+struct Symbol {
+    static constexpr uint32_t kInvalid = UINT32_MAX;
+
+    constexpr Symbol() : id(kInvalid) {}
+    constexpr explicit Symbol(uint32_t i) : id(i) {}
+
+    constexpr bool valid() const {
+        return id != kInvalid;
+    }
+
+    uint32_t id;
+};
+
+inline bool operator==(Symbol a, Symbol b) {
+    return a.id == b.id;
+}
+
+inline bool operator!=(Symbol a, Symbol b) {
+    return a.id != b.id;
+}
+
+inline bool operator<(Symbol a, Symbol b) {
+    return a.id < b.id;
+}
+
+// Interning pool: each distinct string is copied once into large arena
+// chunks and handed back as a Symbol or a StringView that stays valid for
+// the lifetime of the pool.
+class StringPool {
+public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    StringPool() : slots_(16, static_cast<uint32_t>(kEmpty)) {}
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Symbol intern(StringView str) {
+        uint64_t h = Hash64(str.data(), str.size());
+        size_t slot = find_slot(str, h);
+        if (slots_[slot] != kEmpty) {
+            return Symbol(slots_[slot]);
+        }
+
+        if ((views_.size() + 1) * 4 > slots_.size() * 3) {
+            grow();
+            slot = find_slot(str, h);
+        }
+        auto id = static_cast<uint32_t>(views_.size());
+        views_.push_back(StringView(copy(str), str.size()));
+        hashes_.push_back(h);
+        slots_[slot] = id;
+        return Symbol(id);
+    }
+
+    Symbol intern(const std::string& str) {
+        return intern(StringView(str));
+    }
+
+    Symbol intern(const char* str) {
+        return intern(StringView(str));
+    }
+
+    // interns and returns the pooled copy
+    StringView store(StringView str) {
+        return view(intern(str));
+    }
+
+    // the symbol for str if it was interned, an invalid one otherwise
+    Symbol find(StringView str) const {
+        size_t slot = find_slot(str, Hash64(str.data(), str.size()));
+        return slots_[slot] == kEmpty ? Symbol() : Symbol(slots_[slot]);
+    }
+
+    StringView view(Symbol sym) const {
+        assert(sym.id < views_.size());
+        return views_[sym.id];
+    }
+
+    size_t size() const {
+        return views_.size();
+    }
+
+    // arena bytes reserved so far
+    size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    size_t find_slot(StringView str, uint64_t h) const {
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = static_cast<size_t>(h) & mask;; i = (i + 1) & mask) {
+            uint32_t id = slots_[i];
+            if (id == kEmpty) {
+                return i;
+            }
+            if (hashes_[id] == h && views_[id] == str) {
+                return i;
+            }
+        }
+    }
+
+    void grow() {
+        std::vector<uint32_t> slots(slots_.size() * 2, static_cast<uint32_t>(kEmpty));
+        const size_t mask = slots.size() - 1;
+        for (uint32_t id = 0; id < views_.size(); id++) {
+            size_t i = static_cast<size_t>(hashes_[id]) & mask;
+            while (slots[i] != kEmpty) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = id;
+        }
+        slots_.swap(slots);
+    }
+
+    const char* copy(StringView str) {
+        if (str.size() > kChunkSize / 4) {
+            // big strings get a chunk of their own so the current one keeps
+            // serving small strings
+            chunks_.emplace_back(new char[str.size()]);
+            capacity_ += str.size();
+            memcpy(chunks_.back().get(), str.data(), str.size());
+            return chunks_.back().get();
+        }
+        if (chunks_.empty() || left_ < str.size()) {
+            chunks_.emplace_back(new char[kChunkSize]);
+            capacity_ += kChunkSize;
+            cursor_ = chunks_.back().get();
+            left_ = kChunkSize;
+        }
+        char* dst = cursor_;
+        memcpy(dst, str.data(), str.size());
+        cursor_ += str.size();
+        left_ -= str.size();
+        return dst;
+    }
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* cursor_ = nullptr;
+    size_t left_ = 0;
+    size_t capacity_ = 0;
+    std::vector<StringView> views_;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint32_t> slots_;
+};
+}
+
+namespace std {
+template<>
+struct hash<utils::Symbol> {
+    size_t operator()(utils::Symbol sym) const noexcept {
+        return sym.id;
+    }
+};
+}
+
+#endif // INTERN_H
@@ -0,0 +1,226 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <queue>
+
+#include "string_view.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Multi-pattern matcher (Aho-Corasick), built once from a set of patterns
+// and run over StringView inputs in a single pass. The automaton is a full
+// DFA over byte equivalence classes stored in one flat table, so each input
+// byte costs one table load regardless of how many patterns there are.
+class MultiMatcher {
+public:
+    struct Match {
+        size_t offset;      // byte offset of the first matched byte
+        size_t length;
+        uint32_t pattern;   // index into the pattern list
+    };
+
+    // the start state prefilter is used when at most this many distinct
+    // bytes can begin a pattern
+    static constexpr size_t kPrefilterBytes = 4;
+
+    MultiMatcher() = default;
+
+    explicit MultiMatcher(const std::vector<std::string>& patterns) {
+        build(patterns);
+    }
+
+    size_t patterns() const {
+        return lengths_.size();
+    }
+
+    size_t states() const {
+        return classes_ ? delta_.size() / classes_ : 0;
+    }
+
+    // calls on_match(const Match&) for every occurrence of every pattern,
+    // overlapping ones included, ordered by end offset
+    template <typename F>
+    void scan(StringView text, F&& on_match) const {
+        if (delta_.empty()) {
+            return;
+        }
+
+        auto p = reinterpret_cast<const unsigned char*>(text.data());
+        auto end = p + text.size();
+        uint32_t state = 0;
+        while (p < end) {
+            if (state == 0 && !start_bytes_.empty()) {
+                p = skip_to_start(p, end);
+                if (p == end) {
+                    break;
+                }
+            }
+            uint32_t next = delta_[state + class_[*p++]];
+            state = next & ~kOutput;
+            if (next & kOutput) {
+                size_t pos = static_cast<size_t>(p - reinterpret_cast<const unsigned char*>(text.data()));
+                uint32_t last = out_begin_[state / classes_ + 1];
+                for (uint32_t i = out_begin_[state / classes_]; i < last; i++) {
+                    uint32_t id = outputs_[i];
+                    on_match(Match{pos - lengths_[id], lengths_[id], id});
+                }
+            }
+        }
+    }
+
+    std::vector<Match> find_all(StringView text) const {
+        std::vector<Match> result;
+        scan(text, [&result](const Match& m) { result.push_back(m); });
+        return result;
+    }
+
+    bool contains_any(StringView text) const {
+        bool found = false;
+        scan(text, [&found](const Match&) { found = true; });
+        return found;
+    }
+
+private:
+    // set on transitions whose target state reports matches
+    static constexpr uint32_t kOutput = 0x80000000u;
+
+    void build(const std::vector<std::string>& patterns) {
+        // byte equivalence classes: every byte used by a pattern gets its
+        // own class, all other bytes share class 0
+        uint16_t map[256] = {0};
+        uint32_t classes = 1;
+        for (const auto& pattern : patterns) {
+            for (unsigned char c : pattern) {
+                if (!map[c]) {
+                    map[c] = static_cast<uint16_t>(classes++);
+                }
+            }
+        }
+        classes_ = classes;
+
+        // trie, states are stored pre-multiplied by the class count
+        const uint32_t kNone = UINT32_MAX;
+        std::vector<uint32_t> trie(classes_, kNone);
+        std::vector<std::vector<uint32_t>> out(1);
+        for (size_t id = 0; id < patterns.size(); id++) {
+            lengths_.push_back(patterns[id].size());
+            if (patterns[id].empty()) {
+                continue;
+            }
+            uint32_t state = 0;
+            for (unsigned char c : patterns[id]) {
+                uint32_t next = trie[state + map[c]];
+                if (next == kNone) {
+                    next = static_cast<uint32_t>(trie.size());
+                    trie[state + map[c]] = next;
+                    trie.resize(trie.size() + classes_, kNone);
+                    out.emplace_back();
+                }
+                state = next;
+            }
+            out[state / classes_].push_back(static_cast<uint32_t>(id));
+        }
+
+        // breadth first over the trie, turning missing edges into failure
+        // transitions so that the table becomes a complete DFA
+        std::vector<uint32_t> fail(out.size(), 0);
+        std::queue<uint32_t> queue;
+        for (uint32_t c = 0; c < classes_; c++) {
+            if (trie[c] == kNone) {
+                trie[c] = 0;
+            } else {
+                queue.push(trie[c]);
+            }
+        }
+        while (!queue.empty()) {
+            uint32_t state = queue.front();
+            queue.pop();
+            uint32_t f = fail[state / classes_];
+            auto& own = out[state / classes_];
+            const auto& inherited = out[f / classes_];
+            own.insert(own.end(), inherited.begin(), inherited.end());
+            for (uint32_t c = 0; c < classes_; c++) {
+                uint32_t& next = trie[state + c];
+                if (next == kNone) {
+                    next = trie[f + c];
+                } else {
+                    fail[next / classes_] = trie[f + c];
+                    queue.push(next);
+                }
+            }
+        }
+
+        for (auto& next : trie) {
+            if (!out[next / classes_].empty()) {
+                next |= kOutput;
+            }
+        }
+        delta_ = std::move(trie);
+        out_begin_.reserve(out.size() + 1);
+        for (const auto& o : out) {
+            out_begin_.push_back(static_cast<uint32_t>(outputs_.size()));
+            outputs_.insert(outputs_.end(), o.begin(), o.end());
+        }
+        out_begin_.push_back(static_cast<uint32_t>(outputs_.size()));
+
+        for (size_t c = 0; c < 256; c++) {
+            class_[c] = map[c];
+        }
+
+        std::vector<unsigned char> starts;
+        for (size_t c = 0; c < 256; c++) {
+            if (delta_[map[c]] != 0) {
+                starts.push_back(static_cast<unsigned char>(c));
+            }
+        }
+        if (starts.size() <= kPrefilterBytes) {
+            start_bytes_ = std::move(starts);
+        }
+    }
+
+    // in the start state only a byte that begins some pattern can move the
+    // automaton, so jump straight to the next such byte
+    const unsigned char* skip_to_start(const unsigned char* p, const unsigned char* end) const {
+        if (start_bytes_.size() == 1) {
+            auto next = memchr(p, start_bytes_[0], end - p);
+            return next ? static_cast<const unsigned char*>(next) : end;
+        }
+#if defined(__SSE2__)
+        __m128i needles[kPrefilterBytes];
+        for (size_t i = 0; i < start_bytes_.size(); i++) {
+            needles[i] = _mm_set1_epi8(static_cast<char>(start_bytes_[i]));
+        }
+        while (end - p >= 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hit = _mm_cmpeq_epi8(block, needles[0]);
+            for (size_t i = 1; i < start_bytes_.size(); i++) {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[i]));
+            }
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && delta_[class_[*p]] == 0) {
+            ++p;
+        }
+        return p;
+    }
+
+    uint32_t classes_ = 0;
+    uint16_t class_[256] = {0};
+    std::vector<uint32_t> delta_;
+    std::vector<uint32_t> out_begin_;
+    std::vector<uint32_t> outputs_;
+    std::vector<size_t> lengths_;
+    std::vector<unsigned char> start_bytes_;
+};
+
+#endif // MATCHER_H
@@ -5,90 +5,1196 @@
 #ifndef MEMORY_POOL_H
 #define MEMORY_POOL_H
 
+#include <cstdio>
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace memory_pool {
-static constexpr size_t kMaxBlockLen = 512;
+static constexpr size_t kMinBlockShift = 4;
+static constexpr size_t kMinBlockLen = size_t(1) << kMinBlockShift;    // 16
+static constexpr size_t kSizeClasses = 9;                               // 16, 32 ... 4096
+static constexpr size_t kMaxBlockLen = kMinBlockLen << (kSizeClasses - 1);
+
+// smallest class whose blocks hold size bytes, size must be <= kMaxBlockLen
+inline size_t SizeClass(size_t size) {
+    if (size <= kMinBlockLen) {
+        return 0;
+    }
+    return (sizeof(unsigned long long) * 8 - __builtin_clzll(size - 1)) - kMinBlockShift;
+}
+
+constexpr size_t ClassSize(size_t cls) {
+    return kMinBlockLen << cls;
+}
 
+// a free block, linked through its own storage
 struct MemoryNode
 {
-    MemoryNode() {
-        memset(block, 0x00, sizeof(block));
+    MemoryNode *next;
+};
+
+enum class SlabBacking
+{
+    kHeap,          // operator new
+    kMmap,          // anonymous mmap, madvise(MADV_HUGEPAGE) for slabs of 2 MB and up
+    kHugePages,     // MAP_HUGETLB, falls back to kMmap when no huge page is free
+};
+
+struct PoolOptions
+{
+    size_t slab_size = 64 * 1024;   // bytes per slab, 64 KB to 2 MB works well
+    size_t max_bytes = 0;           // cap on slab memory, 0 means unbounded
+    bool zero_blocks = false;       // hand out zero-filled blocks
+    SlabBacking backing = SlabBacking::kHeap;
+    bool numa_local = false;        // place slabs on the NUMA node of the allocating thread
+};
+
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+inline bool MapsSlabs(const PoolOptions& options) {
+    return options.backing != SlabBacking::kHeap || options.numa_local;
+}
+
+// bytes actually reserved for a slab of len bytes
+inline size_t SlabLength(size_t len, const PoolOptions& options) {
+    if (!MapsSlabs(options)) {
+        return len;
+    }
+    size_t unit = options.backing == SlabBacking::kHugePages ? kHugePageSize : 4096;
+    return (len + unit - 1) / unit * unit;
+}
+
+#if defined(__linux__)
+// node of the cpu the calling thread runs on, 0 when unknown
+inline unsigned CurrentNode() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return node;
+}
+
+inline char* MapSlab(size_t len, const PoolOptions& options) {
+    void* p = MAP_FAILED;
+    if (options.backing == SlabBacking::kHugePages) {
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED && len >= kHugePageSize && options.backing != SlabBacking::kHeap) {
+        // over-map and trim so the slab starts on a huge page boundary,
+        // transparent huge pages only back aligned 2 MB ranges
+        void* raw = mmap(nullptr, len + kHugePageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            auto base = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = (base + kHugePageSize - 1) & ~(kHugePageSize - 1);
+            if (aligned > base) {
+                munmap(raw, aligned - base);
+            }
+            munmap(reinterpret_cast<void*>(aligned + len), base + kHugePageSize - aligned);
+            p = reinterpret_cast<void*>(aligned);
+            madvise(p, len, MADV_HUGEPAGE);
+        }
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    if (options.numa_local) {
+        // preferred rather than bound, so a full node spills over instead
+        // of failing; pages are placed on first touch after this call
+        const int kMpolPreferred = 1;
+        unsigned long mask = 1ul << (CurrentNode() % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, p, len, kMpolPreferred, &mask, 8 * sizeof(mask), 0);
+    }
+    return static_cast<char*>(p);
+}
+#endif
+
+// slab memory for the pools, len must come from SlabLength
+inline char* AllocateSlab(size_t len, const PoolOptions& options) {
+#if defined(__linux__)
+    if (MapsSlabs(options)) {
+        return MapSlab(len, options);
+    }
+#endif
+    return new (std::nothrow) char[len];
+}
+
+inline void FreeSlab(char* slab, size_t len, const PoolOptions& options) {
+#if defined(__linux__)
+    if (MapsSlabs(options)) {
+        munmap(slab, len);
+        return;
+    }
+#endif
+    (void)len;
+    (void)options;
+    delete[] slab;
+}
+
+// Snapshot of a pool's counters, see MemoryPool::stats()
+struct PoolStats
+{
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    uint64_t live = 0;                      // allocs - frees
+    uint64_t high_water = 0;                // peak live pool blocks, summed per class
+    uint64_t heap_fallbacks = 0;            // requests above kMaxBlockLen
+    uint64_t failures = 0;                  // allocations that returned nullptr
+    uint64_t hits[kSizeClasses] = {};       // served from a free list
+    uint64_t misses[kSizeClasses] = {};     // needed fresh slab memory
+    uint64_t double_frees = 0;              // MEMORY_POOL_DEBUG only
+    uint64_t corruptions = 0;               // MEMORY_POOL_DEBUG only
+};
+
+// Counter with a single writer and any number of readers: updates are a
+// relaxed load and store, so they cost no locked instruction.
+class StatCounter
+{
+public:
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t v) {
+        value_.store(v, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+struct PoolCounters
+{
+    // adds the counters to a snapshot, live and high_water are left to the
+    // pool; allocs is derived so the fast path updates a single counter
+    void add_to(PoolStats& stats) const {
+        stats.allocs += heap_fallbacks.get();
+        stats.frees += frees.get();
+        stats.heap_fallbacks += heap_fallbacks.get();
+        stats.failures += failures.get();
+        stats.double_frees += double_frees.get();
+        stats.corruptions += corruptions.get();
+        for (size_t cls = 0; cls < kSizeClasses; cls++) {
+            stats.hits[cls] += hits[cls].get();
+            stats.misses[cls] += misses[cls].get();
+            stats.allocs += hits[cls].get() + misses[cls].get();
+        }
     }
 
-    ~MemoryNode() = default;
+    StatCounter frees;
+    StatCounter heap_fallbacks;
+    StatCounter failures;
+    StatCounter double_frees;
+    StatCounter corruptions;
+    StatCounter hits[kSizeClasses];
+    StatCounter misses[kSizeClasses];
+};
+
+#if defined(MEMORY_POOL_DEBUG)
+// Debug block layout: [state][canary][object ...][canary]. The state word
+// reads kLive while the block is handed out; the free list link overwrites
+// it on release, so freeing the block again finds something else there.
+// Both canaries are checked on release to catch over- and underruns.
+struct DebugGuard
+{
+    static constexpr uint64_t kLive = 0x4c4956454d504f4full;
+    static constexpr uint64_t kCanary = 0xfdfdfdfdfdfdfdfdull;
+    static constexpr size_t kFront = 2 * sizeof(uint64_t);
+    static constexpr size_t kOverhead = kFront + sizeof(uint64_t);
 
-    char block[kMaxBlockLen];
-    bool is_use = false;
-    MemoryNode *next = nullptr;
+    static void* arm(void* block, size_t size) {
+        auto p = static_cast<char*>(block);
+        uint64_t word = kLive;
+        memcpy(p, &word, sizeof(word));
+        word = kCanary;
+        memcpy(p + sizeof(word), &word, sizeof(word));
+        memcpy(p + kFront + size, &word, sizeof(word));
+        return p + kFront;
+    }
+
+    // the block behind p, or nullptr when it must not be released
+    static void* disarm(void* p, size_t size, PoolCounters& counters) {
+        auto block = static_cast<char*>(p) - kFront;
+        uint64_t state, head, tail;
+        memcpy(&state, block, sizeof(state));
+        memcpy(&head, block + sizeof(state), sizeof(head));
+        memcpy(&tail, static_cast<char*>(p) + size, sizeof(tail));
+        if (state != kLive) {
+            counters.double_frees.add();
+            fprintf(stderr, "memory_pool: double free or foreign pointer %p\n", p);
+            return nullptr;
+        }
+        if (head != kCanary || tail != kCanary) {
+            counters.corruptions.add();
+            fprintf(stderr, "memory_pool: %s of %zu byte block %p\n",
+                    head != kCanary ? "underrun" : "overrun", size, p);
+        }
+        state = 0;
+        memcpy(block, &state, sizeof(state));
+        return block;
+    }
 };
 
+// bytes a pool block needs to carry size bytes of payload
+inline size_t GuardedSize(size_t size) {
+    return size + DebugGuard::kOverhead;
+}
+#else
+inline size_t GuardedSize(size_t size) {
+    return size;
+}
+#endif
+
+// Size-class segregated pool: sizes are rounded up to a power of two from
+// 16 to 4096 bytes and each class keeps its own free list, anything larger
+// goes to operator new. Blocks carry no header, so free_node must be
+// called with the same type find_node returned.
+//
+// Each class draws memory from contiguous slabs: freed blocks are reused
+// first, then the current slab is bump allocated, and a new slab is added
+// on demand until max_bytes is reached.
 class MemoryPool
 {
 public:
-    MemoryPool() = default;
+    explicit MemoryPool(const PoolOptions& options = PoolOptions()) : options_(options) {
+        if (options_.backing == SlabBacking::kHugePages) {
+            options_.slab_size = SlabLength(options_.slab_size, options_);
+        }
+    }
+
     ~MemoryPool() {
-        MemoryNode* node = this->next;
-        while (node) {
-            auto tmp = node;
-            node = node->next;
-            delete tmp;
-            tmp = nullptr;
+        for (size_t cls = 0; cls < kSizeClasses; cls++) {
+            for (auto slab : slabs_[cls]) {
+                FreeSlab(slab, slab_length(cls), options_);
+            }
         }
     }
 
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    // makes room for count more blocks in every size class. The slabs are
+    // carved when a class is first allocated from, so a class that is never
+    // used costs nothing and one that is holds at least one slab
+    // (slab_size, 64 KB by default); reserve() carves right away.
     void init(size_t count = 100) {
-        MemoryNode** cur = &(this->next);
-        size_t index = 0;
-        while (index++ < count) {
-            *cur = new MemoryNode();
-            cur = &((*cur)->next);
+        for (size_t cls = 0; cls < kSizeClasses; cls++) {
+            deferred_[cls] += count;
+        }
+    }
+
+    // makes room for count more blocks in the class serving size bytes
+    void reserve(size_t size, size_t count) {
+        size = GuardedSize(size);
+        if (size <= kMaxBlockLen) {
+            add_blocks(SizeClass(size), count);
         }
     }
 
     template <typename T, typename... Args>
     T* find_node(Args&&... args) {
-        size_t len = sizeof(T);
-        if (len > kMaxBlockLen) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        void* p = allocate(sizeof(T));
+        if (!p) {
+            return nullptr;
+        }
+        return new(p)T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    bool free_node(T* t) {
+        if (t) {
+            t->~T();
+            deallocate(t, sizeof(T));
+            return true;
+        }
+        return false;
+    }
+
+    void* allocate(size_t size) {
+#if defined(MEMORY_POOL_DEBUG)
+        void* block = allocate_block(GuardedSize(size));
+        return block ? DebugGuard::arm(block, size) : nullptr;
+#else
+        return allocate_block(size);
+#endif
+    }
+
+    void deallocate(void* p, size_t size) {
+#if defined(MEMORY_POOL_DEBUG)
+        p = DebugGuard::disarm(p, size, counters_);
+        if (!p) {
+            return;
+        }
+#endif
+        deallocate_block(p, GuardedSize(size));
+    }
+
+    // returns every block to the pool, slabs are kept
+    void clear() {
+        // blocks from operator new stay live
+        PoolStats before = stats();
+        cleared_.add(before.live - (before.heap_fallbacks - heap_frees_.get()));
+        for (size_t cls = 0; cls < kSizeClasses; cls++) {
+            free_[cls] = nullptr;
+            current_[cls] = 0;
+            cursor_[cls] = limit_[cls] = nullptr;
+            available_[cls] = capacity(cls);
+            // the bump pointer restarts, so misses count the class peak anew
+            uint64_t misses = counters_.misses[cls].get();
+            if (misses - carved_base_[cls].get() > peak_[cls].get()) {
+                peak_[cls].set(misses - carved_base_[cls].get());
+            }
+            carved_base_[cls].set(misses);
+            if (!slabs_[cls].empty()) {
+                cursor_[cls] = slabs_[cls][0];
+                limit_[cls] = cursor_[cls] + blocks_per_slab(cls) * ClassSize(cls);
+            }
+        }
+    }
+
+    size_t capacity(size_t cls) const {
+        return slabs_[cls].size() * blocks_per_slab(cls);
+    }
+
+    size_t available(size_t cls) const {
+        return available_[cls];
+    }
+
+    // slab memory held by the pool
+    size_t bytes() const {
+        return bytes_;
+    }
+
+    // counters since construction, safe to call from any thread
+    PoolStats stats() const {
+        PoolStats stats;
+        counters_.add_to(stats);
+        stats.live = stats.allocs - stats.frees - cleared_.get();
+        for (size_t cls = 0; cls < kSizeClasses; cls++) {
+            // a class only bump allocates once every carved block is live,
+            // so the blocks carved are its peak live count
+            uint64_t carved = stats.misses[cls] - carved_base_[cls].get();
+            stats.high_water += carved > peak_[cls].get() ? carved : peak_[cls].get();
+        }
+        return stats;
+    }
+
+private:
+    void* allocate_block(size_t size) {
+        if (size > kMaxBlockLen) {
+            return allocate_large(size);
+        }
+
+        size_t cls = SizeClass(size);
+        MemoryNode* node = free_[cls];
+        if (!node) {
+            return allocate_fresh(cls);
+        }
+        free_[cls] = node->next;
+        counters_.hits[cls].add();
+        available_[cls]--;
+        if (options_.zero_blocks) {
+            memset(node, 0x00, ClassSize(cls));
+        }
+        return node;
+    }
+
+    // the slow paths stay out of line so the free list hit inlines
+    __attribute__((noinline)) void* allocate_large(size_t size) {
+        void* p = ::operator new(size, std::nothrow);
+        if (!p) {
+            counters_.failures.add();
             return nullptr;
         }
+        counters_.heap_fallbacks.add();
+        return p;
+    }
+
+    __attribute__((noinline)) void* allocate_fresh(size_t cls) {
+        if (deferred_[cls]) {
+            size_t count = deferred_[cls];
+            deferred_[cls] = 0;
+            add_blocks(cls, count);
+        }
+        if (cursor_[cls] == limit_[cls] && !next_slab(cls)) {
+            counters_.failures.add();
+            return nullptr;
+        }
+        void* p = cursor_[cls];
+        cursor_[cls] += ClassSize(cls);
+        counters_.misses[cls].add();
+        available_[cls]--;
+        if (options_.zero_blocks) {
+            memset(p, 0x00, ClassSize(cls));
+        }
+        return p;
+    }
+
+    void deallocate_block(void* p, size_t size) {
+        counters_.frees.add();
+        if (size > kMaxBlockLen) {
+            heap_frees_.add();
+            ::operator delete(p);
+            return;
+        }
+
+        size_t cls = SizeClass(size);
+        MemoryNode* node = static_cast<MemoryNode*>(p);
+        node->next = free_[cls];
+        free_[cls] = node;
+        available_[cls]++;
+    }
+
+    size_t blocks_per_slab(size_t cls) const {
+        size_t n = options_.slab_size / ClassSize(cls);
+        return n ? n : 1;
+    }
+
+    size_t slab_length(size_t cls) const {
+        return SlabLength(blocks_per_slab(cls) * ClassSize(cls), options_);
+    }
 
-        MemoryNode* node = this->next;
-        while(node) {
-            if (!node->is_use) {
+    void add_blocks(size_t cls, size_t count) {
+        size_t per_slab = blocks_per_slab(cls);
+        for (size_t n = 0; n < count; n += per_slab) {
+            if (!add_slab(cls)) {
                 break;
             }
-            node = node->next;
         }
+        if (!cursor_[cls] && !slabs_[cls].empty()) {
+            cursor_[cls] = slabs_[cls][0];
+            limit_[cls] = cursor_[cls] + per_slab * ClassSize(cls);
+        }
+    }
+
+    bool add_slab(size_t cls) {
+        size_t len = slab_length(cls);
+        if (options_.max_bytes && bytes_ + len > options_.max_bytes) {
+            return false;
+        }
+        char* slab = AllocateSlab(len, options_);
+        if (!slab) {
+            return false;
+        }
+        slabs_[cls].push_back(slab);
+        bytes_ += len;
+        available_[cls] += blocks_per_slab(cls);
+        return true;
+    }
+
+    // moves the bump pointer to the following slab, growing if needed
+    bool next_slab(size_t cls) {
+        size_t next = cursor_[cls] ? current_[cls] + 1 : 0;
+        if (next >= slabs_[cls].size() && !add_slab(cls)) {
+            return false;
+        }
+        current_[cls] = next;
+        cursor_[cls] = slabs_[cls][next];
+        limit_[cls] = cursor_[cls] + blocks_per_slab(cls) * ClassSize(cls);
+        return true;
+    }
+
+    PoolOptions options_;
+    MemoryNode* free_[kSizeClasses] = {};
+    char* cursor_[kSizeClasses] = {};
+    char* limit_[kSizeClasses] = {};
+    size_t current_[kSizeClasses] = {};
+    size_t available_[kSizeClasses] = {};
+    size_t deferred_[kSizeClasses] = {};        // blocks init() left for the first allocation
+    std::vector<char*> slabs_[kSizeClasses];
+    size_t bytes_ = 0;
+    PoolCounters counters_;
+    StatCounter heap_frees_;
+    StatCounter cleared_;                       // live blocks dropped by clear()
+    StatCounter carved_base_[kSizeClasses];     // misses at the last clear()
+    StatCounter peak_[kSizeClasses];            // peak live blocks before it
+};
+
+// Standard allocator drawing from a pool (MemoryPool or ConcurrentMemoryPool),
+// so node based containers such as std::list and std::unordered_map get
+// their nodes from a size-class free list. Allocators compare equal when
+// they share a pool, and the pool follows the container on copy, move and
+// swap. The pool must outlive every container using it.
+template <typename T, typename Pool = MemoryPool>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind {
+        using other = PoolAllocator<U, Pool>;
+    };
+
+    explicit PoolAllocator(Pool& pool) noexcept : pool_(&pool) {}
 
-        if (node) {
-            node->is_use = true;
-            return new(node->block)T(std::forward<Args>(args)...);
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, Pool>& other) noexcept : pool_(other.pool()) {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        if (n > static_cast<size_t>(-1) / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void* p = pool_->allocate(n * sizeof(T));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        pool_->deallocate(p, n * sizeof(T));
+    }
+
+    Pool* pool() const noexcept {
+        return pool_;
+    }
+
+private:
+    Pool* pool_;
+};
+
+template <typename T, typename U, typename Pool>
+bool operator==(const PoolAllocator<T, Pool>& a, const PoolAllocator<U, Pool>& b) {
+    return a.pool() == b.pool();
+}
+
+template <typename T, typename U, typename Pool>
+bool operator!=(const PoolAllocator<T, Pool>& a, const PoolAllocator<U, Pool>& b) {
+    return a.pool() != b.pool();
+}
+
+// Monotonic bump-pointer arena for short-lived data such as a request's
+// temporaries. Chunks are chained and kept after a rewind, so a steady
+// state workload stops calling the system allocator; deallocate is a no-op
+// and everything allocated since a mark goes away with one rewind().
+class Arena
+{
+public:
+    struct Mark {
+        size_t chunk;
+        char* cursor;
+    };
+
+    explicit Arena(size_t chunk_size = 64 * 1024) : chunk_size_(chunk_size) {}
+
+    ~Arena() {
+        for (auto& chunk : chunks_) {
+            delete[] chunk.base;
+        }
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        char* p = align_up(cursor_, align);
+        if (!cursor_ || p + size > limit_) {
+            p = align_up(next_chunk(size + align), align);
+        }
+        cursor_ = p + size;
+        return p;
+    }
+
+    void deallocate(void*, size_t) {}
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new(allocate(sizeof(T), alignof(T)))T(std::forward<Args>(args)...);
+    }
+
+    Mark mark() const {
+        return Mark{current_, cursor_};
+    }
+
+    // drops everything allocated after m, chunks are kept for reuse
+    void rewind(const Mark& m) {
+        current_ = m.chunk;
+        cursor_ = m.cursor;
+        limit_ = chunks_.empty() ? nullptr : chunks_[current_].base + chunks_[current_].size;
+        if (!cursor_ && !chunks_.empty()) {
+            cursor_ = chunks_[current_].base;
+        }
+    }
+
+    void reset() {
+        rewind(Mark{0, nullptr});
+    }
+
+    // bytes held in chunks
+    size_t capacity() const {
+        size_t total = 0;
+        for (auto& chunk : chunks_) {
+            total += chunk.size;
+        }
+        return total;
+    }
+
+private:
+    struct Chunk {
+        char* base;
+        size_t size;
+    };
+
+    static char* align_up(char* p, size_t align) {
+        auto v = reinterpret_cast<uintptr_t>(p);
+        return reinterpret_cast<char*>((v + align - 1) & ~(uintptr_t(align) - 1));
+    }
+
+    // moves to the next chunk holding at least size bytes, reusing chunks
+    // left behind by a rewind before allocating a new one
+    char* next_chunk(size_t size) {
+        size_t next = cursor_ ? current_ + 1 : current_;
+        if (next >= chunks_.size() || chunks_[next].size < size) {
+            size_t len = size > chunk_size_ ? size : chunk_size_;
+            chunks_.insert(chunks_.begin() + next, Chunk{new char[len], len});
+        }
+        current_ = next;
+        cursor_ = chunks_[next].base;
+        limit_ = cursor_ + chunks_[next].size;
+        return cursor_;
+    }
+
+    size_t chunk_size_;
+    std::vector<Chunk> chunks_;
+    size_t current_ = 0;
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+};
+
+// rewinds the arena to where it was when the scope was entered
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena& arena) : arena_(arena), mark_(arena.mark()) {}
+
+    ~ArenaScope() {
+        arena_.rewind(mark_);
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena& arena_;
+    Arena::Mark mark_;
+};
+
+template <typename T>
+using ArenaAllocator = PoolAllocator<T, Arena>;
+
+// Default recycling policy for ObjectPool: calls clear() when T has one,
+// which keeps the capacity of string and container members, otherwise
+// rebuilds the object in place.
+template <typename T>
+struct ObjectReset
+{
+    template <typename U>
+    static auto reset(U& obj, int) -> decltype(obj.clear(), void()) {
+        obj.clear();
+    }
+
+    template <typename U>
+    static void reset(U& obj, long) {
+        obj.~U();
+        new(&obj) U();
+    }
+
+    void operator()(T& obj) const {
+        reset(obj, 0);
+    }
+};
+
+// Pool of constructed objects handed out as unique_ptr style handles that
+// give the object back when they go out of scope. Released objects are
+// either destroyed, or, while fewer than max_idle are parked, reset with
+// Reset and kept alive for acquire() so expensive members keep their
+// buffers. Handles must not outlive the pool.
+template <typename T, typename Reset = ObjectReset<T>>
+class ObjectPool
+{
+public:
+    class Deleter {
+    public:
+        Deleter() = default;
+        explicit Deleter(ObjectPool* pool) : pool_(pool) {}
+
+        void operator()(T* obj) const {
+            pool_->release(obj);
+        }
+
+    private:
+        ObjectPool* pool_ = nullptr;
+    };
+
+    using Handle = std::unique_ptr<T, Deleter>;
+
+    explicit ObjectPool(size_t max_idle = 0, const PoolOptions& options = PoolOptions())
+        : pool_(options), max_idle_(max_idle) {}
+
+    ~ObjectPool() {
+        for (auto obj : idle_) {
+            pool_.free_node(obj);
+        }
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // a freshly constructed object, empty handle when the pool is capped
+    template <typename... Args>
+    Handle make(Args&&... args) {
+        return Handle(pool_.template find_node<T>(std::forward<Args>(args)...), Deleter(this));
+    }
+
+    // a recycled object if one is parked, a default constructed one otherwise
+    Handle acquire() {
+        if (idle_.empty()) {
+            return make();
+        }
+        T* obj = idle_.back();
+        idle_.pop_back();
+        return Handle(obj, Deleter(this));
+    }
+
+    size_t idle() const {
+        return idle_.size();
+    }
+
+private:
+    void release(T* obj) {
+        if (idle_.size() < max_idle_) {
+            reset_(*obj);
+            idle_.push_back(obj);
+        } else {
+            pool_.free_node(obj);
+        }
+    }
+
+    MemoryPool pool_;
+    size_t max_idle_;
+    Reset reset_;
+    std::vector<T*> idle_;
+};
+
+// Lock-free stack (Treiber) of block batches. The 16 bits above a 48-bit
+// user-space pointer hold a counter bumped on every update, which defeats
+// ABA when a batch is popped and pushed back between a load and the CAS.
+// Blocks are never returned to the system while the stack is in use, so
+// reading next_batch of a batch that was just popped by someone else is
+// safe, the CAS then fails on the tag.
+class BatchStack
+{
+public:
+    struct Batch {
+        MemoryNode *next;                   // the batch is the first block of its chain
+        std::atomic<Batch*> next_batch;
+    };
+
+    static_assert(sizeof(void*) == 8, "tagged pointers need a 64-bit address space");
+    static_assert(sizeof(Batch) <= kMinBlockLen, "batch header must fit the smallest block");
+
+    void push(Batch* batch) {
+        uint64_t old = head_.load(std::memory_order_relaxed);
+        do {
+            batch->next_batch.store(pointer(old), std::memory_order_relaxed);
+        } while (!head_.compare_exchange_weak(old, pack(batch, old), std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    Batch* pop() {
+        uint64_t old = head_.load(std::memory_order_acquire);
+        while (Batch* top = pointer(old)) {
+            Batch* next = top->next_batch.load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(old, pack(next, old), std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                return top;
+            }
         }
         return nullptr;
     }
 
+private:
+    static constexpr uint64_t kPointerMask = (uint64_t(1) << 48) - 1;
+
+    static Batch* pointer(uint64_t v) {
+        return reinterpret_cast<Batch*>(v & kPointerMask);
+    }
+
+    static uint64_t pack(Batch* p, uint64_t old) {
+        return reinterpret_cast<uint64_t>(p) | ((old & ~kPointerMask) + (kPointerMask + 1));
+    }
+
+    std::atomic<uint64_t> head_{0};
+};
+
+// Thread-safe size-class pool in the tcmalloc style. Each thread allocates
+// from and frees into its own per-class free lists; only when a list runs
+// dry does it take a whole batch from the lock-free central stacks, and
+// when it reaches two batches it hands back all but one, so one thread may
+// free what another allocated and no cache keeps what it freed. New memory
+// is carved from chunks of options.slab_size bytes (64 KB by default)
+// under a mutex and all but one batch of a new chunk goes straight to the
+// central stack. With numa_local set each chunk is placed on the node of
+// the thread that carves it and there is one set of central stacks per
+// node, picked with getcpu on every refill and hand-back, so a thread only
+// draws batches carved or freed on its own node; blocks freed on another
+// node join that node's stacks. max_bytes and zero_blocks are not
+// supported.
+class ConcurrentMemoryPool
+{
+public:
+    explicit ConcurrentMemoryPool(const PoolOptions& options = PoolOptions())
+        : central_(std::make_shared<Central>(options)) {}
+
+    ~ConcurrentMemoryPool() {
+        // thread caches still holding blocks keep the central state alive
+        // and are dropped the next time their thread looks up a cache
+        central_->closed.store(true, std::memory_order_release);
+    }
+
+    ConcurrentMemoryPool(const ConcurrentMemoryPool&) = delete;
+    ConcurrentMemoryPool& operator=(const ConcurrentMemoryPool&) = delete;
+
+    // blocks moved between a thread cache and the central stacks at once
+    static size_t BatchSize(size_t cls) {
+        size_t n = 8192 / ClassSize(cls);
+        return n < 4 ? 4 : (n > 64 ? 64 : n);
+    }
+
+    template <typename T, typename... Args>
+    T* find_node(Args&&... args) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        void* p = allocate(sizeof(T));
+        if (!p) {
+            return nullptr;
+        }
+        return new(p)T(std::forward<Args>(args)...);
+    }
+
     template<typename T>
     bool free_node(T* t) {
-        MemoryNode* node = (MemoryNode* )t;
-        if (node) {
-            node->is_use = false;
-            memset(node->block, 0x00, sizeof(node->block));
+        if (t) {
+            t->~T();
+            deallocate(t, sizeof(T));
             return true;
         }
         return false;
     }
 
-    void clear() {
-        MemoryNode* node = this->next;
-        while(node) {
-            memset(node->block, 0x00, sizeof(node->block));
-            node->is_use = false;
+    void* allocate(size_t size) {
+#if defined(MEMORY_POOL_DEBUG)
+        void* block = allocate_block(GuardedSize(size));
+        return block ? DebugGuard::arm(block, size) : nullptr;
+#else
+        return allocate_block(size);
+#endif
+    }
+
+    void deallocate(void* p, size_t size) {
+#if defined(MEMORY_POOL_DEBUG)
+        p = DebugGuard::disarm(p, size, cache().counters());
+        if (!p) {
+            return;
         }
+#endif
+        deallocate_block(p, GuardedSize(size));
+    }
+
+    // bytes carved from the system so far
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(central_->mutex);
+        return central_->chunks.size() * central_->chunk_size;
+    }
+
+    // Sums the per-thread counters of live and exited threads. A miss is a
+    // thread cache refill, and since frees may happen on another thread
+    // than the allocation, high_water reports the blocks carved from the
+    // system, an upper bound of the peak live count.
+    PoolStats stats() const {
+        PoolStats stats;
+        {
+            std::lock_guard<std::mutex> lock(central_->mutex);
+            stats = central_->retired;
+            for (auto cache : central_->caches) {
+                cache->counters().add_to(stats);
+            }
+        }
+        stats.live = stats.allocs - stats.frees;
+        stats.high_water = central_->carved.load(std::memory_order_relaxed);
+        return stats;
     }
 
 private:
-    MemoryNode *next;
+    class ThreadCache;
+
+    struct Central {
+        explicit Central(const PoolOptions& o)
+            : options(o), chunk_size(SlabLength(o.slab_size < kMaxBlockLen ? kMaxBlockLen : o.slab_size, o)),
+              nodes(o.numa_local ? kMaxNodes : 1), batches(new BatchStack[nodes * kSizeClasses]) {}
+
+        ~Central() {
+            for (auto chunk : chunks) {
+                FreeSlab(chunk, chunk_size, options);
+            }
+        }
+
+        // the stacks of class cls for the node the calling thread runs on
+        BatchStack& stack(size_t cls) {
+            size_t node = 0;
+#if defined(__linux__)
+            if (nodes > 1) {
+                node = CurrentNode() % nodes;
+            }
+#endif
+            return batches[node * kSizeClasses + cls];
+        }
+
+        // nodes with their own stacks, the bits of the mbind mask
+        static constexpr size_t kMaxNodes = 64;
+
+        const PoolOptions options;
+        const size_t chunk_size;
+        const size_t nodes;
+
+        std::unique_ptr<BatchStack[]> batches;  // kSizeClasses per node
+        std::atomic<bool> closed{false};
+        std::atomic<uint64_t> carved{0};
+        mutable std::mutex mutex;
+        std::vector<char*> chunks;
+        std::vector<const ThreadCache*> caches;
+        PoolStats retired;      // counters of destroyed thread caches
+    };
+
+    void* allocate_block(size_t size) {
+        ThreadCache& cache = this->cache();
+        PoolCounters& counters = cache.counters();
+        void* p;
+        if (size > kMaxBlockLen) {
+            p = ::operator new(size, std::nothrow);
+            if (p) {
+                counters.heap_fallbacks.add();
+            }
+        } else {
+            p = cache.pop(SizeClass(size));
+        }
+        if (!p) {
+            counters.failures.add();
+        }
+        return p;
+    }
+
+    void deallocate_block(void* p, size_t size) {
+        ThreadCache& cache = this->cache();
+        cache.counters().frees.add();
+        if (size > kMaxBlockLen) {
+            ::operator delete(p);
+            return;
+        }
+        cache.push(SizeClass(size), p);
+    }
+
+    class ThreadCache {
+    public:
+        explicit ThreadCache(std::shared_ptr<Central> central) : central_(std::move(central)) {
+            std::lock_guard<std::mutex> lock(central_->mutex);
+            central_->caches.push_back(this);
+        }
+
+        ~ThreadCache() {
+            for (size_t cls = 0; cls < kSizeClasses; cls++) {
+                BatchStack& stack = central_->stack(cls);
+                while (count_[cls]) {
+                    release(cls, count_[cls] < BatchSize(cls) ? count_[cls] : BatchSize(cls), stack);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(central_->mutex);
+            counters_.add_to(central_->retired);
+            auto& caches = central_->caches;
+            for (size_t i = 0; i < caches.size(); i++) {
+                if (caches[i] == this) {
+                    caches[i] = caches.back();
+                    caches.pop_back();
+                    break;
+                }
+            }
+        }
+
+        const Central* central() const {
+            return central_.get();
+        }
+
+        PoolCounters& counters() {
+            return counters_;
+        }
+
+        const PoolCounters& counters() const {
+            return counters_;
+        }
+
+        void* pop(size_t cls) {
+            if (free_[cls]) {
+                counters_.hits[cls].add();
+            } else {
+                if (!refill(cls)) {
+                    return nullptr;
+                }
+                counters_.misses[cls].add();
+            }
+            MemoryNode* node = free_[cls];
+            free_[cls] = node->next;
+            count_[cls]--;
+            return node;
+        }
+
+        void push(size_t cls, void* p) {
+            MemoryNode* node = static_cast<MemoryNode*>(p);
+            node->next = free_[cls];
+            free_[cls] = node;
+            if (++count_[cls] >= 2 * BatchSize(cls)) {
+                flush(cls);
+            }
+        }
+
+    private:
+        __attribute__((noinline)) bool refill(size_t cls) {
+            if (auto batch = central_->stack(cls).pop()) {
+                size_t count = 0;
+                for (MemoryNode* node = reinterpret_cast<MemoryNode*>(batch); node; node = node->next) {
+                    count++;
+                }
+                free_[cls] = reinterpret_cast<MemoryNode*>(batch);
+                count_[cls] = count;
+                return true;
+            }
+
+            char* chunk = AllocateSlab(central_->chunk_size, central_->options);
+            if (!chunk) {
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(central_->mutex);
+                central_->chunks.push_back(chunk);
+            }
+            size_t blocks = central_->chunk_size / ClassSize(cls);
+            central_->carved.fetch_add(blocks, std::memory_order_relaxed);
+            for (size_t i = blocks; i > 0; i--) {
+                MemoryNode* node = reinterpret_cast<MemoryNode*>(chunk + (i - 1) * ClassSize(cls));
+                node->next = free_[cls];
+                free_[cls] = node;
+            }
+            count_[cls] = blocks;
+            // the rest of the chunk goes to the central stack for any thread
+            flush(cls);
+            return true;
+        }
+
+        // keeps one batch cached and hands the rest back in batches, so a
+        // cache never holds more than two batches of a class
+        void flush(size_t cls) {
+            size_t batch = BatchSize(cls);
+            BatchStack& stack = central_->stack(cls);
+            while (count_[cls] > batch) {
+                release(cls, count_[cls] - batch < batch ? count_[cls] - batch : batch, stack);
+            }
+        }
+
+        // hands the first n cached blocks to stack as one batch
+        __attribute__((noinline)) void release(size_t cls, size_t n, BatchStack& stack) {
+            MemoryNode* first = free_[cls];
+            MemoryNode* last = first;
+            for (size_t i = 1; i < n; i++) {
+                last = last->next;
+            }
+            free_[cls] = last->next;
+            last->next = nullptr;
+            count_[cls] -= n;
+
+            auto batch = reinterpret_cast<BatchStack::Batch*>(first);
+            // default-initialised so the only write is push's atomic store, a
+            // racing pop may still be reading this block's old link
+            new (&batch->next_batch) std::atomic<BatchStack::Batch*>;
+            stack.push(batch);
+        }
+
+        std::shared_ptr<Central> central_;
+        MemoryNode* free_[kSizeClasses] = {};
+        size_t count_[kSizeClasses] = {};
+        PoolCounters counters_;
+    };
+
+    struct LocalCaches {
+        std::vector<std::unique_ptr<ThreadCache>> caches;
+        const Central* last_central = nullptr;
+        ThreadCache* last = nullptr;
+    };
+
+    static LocalCaches& local() {
+        static thread_local LocalCaches caches;
+        return caches;
+    }
+
+    ThreadCache& cache() {
+        LocalCaches& local = ConcurrentMemoryPool::local();
+        if (local.last_central == central_.get()) {
+            return *local.last;
+        }
+
+        ThreadCache* found = nullptr;
+        auto& caches = local.caches;
+        for (size_t i = 0; i < caches.size();) {
+            if (caches[i]->central()->closed.load(std::memory_order_acquire)) {
+                caches[i] = std::move(caches.back());
+                caches.pop_back();
+                continue;
+            }
+            if (caches[i]->central() == central_.get()) {
+                found = caches[i].get();
+            }
+            i++;
+        }
+        if (!found) {
+            caches.emplace_back(new ThreadCache(central_));
+            found = caches.back().get();
+        }
+        local.last_central = central_.get();
+        local.last = found;
+        return *found;
+    }
+
+    std::shared_ptr<Central> central_;
 };
 }
 
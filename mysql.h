@@ -4,24 +4,27 @@
 #include <cstring>
 
 #include <iostream>
+#include <type_traits>
 #include <unordered_map>
 
 #include <mysql/mysql.h>
 
+#include "string_map.h"
+
 namespace sql {
 class Row {
 public:
     Row() = default;
-    Row(MYSQL_ROW row, const std::unordered_map<std::string, size_t>& field2index)
-        : _row(row), _field2index(field2index) {}
+    Row(MYSQL_ROW row, const utils::StringMap<size_t>& field2index)
+        : _row(row), _field2index(&field2index) {}
 
     Row(Row&& x) : _row(x._row), _field2index(x._field2index) {
         x._row = nullptr;
     }
 
     Row& operator=(Row&& x) {
-        using std::swap;
-        swap(*this, x);
+        std::swap(_row, x._row);
+        std::swap(_field2index, x._field2index);
         return *this;
     }
 
@@ -30,31 +33,60 @@ public:
     }
 
     std::string operator[](size_t n) {
-        if (n > _field2index.size()) {
+        if (!_field2index || n >= _field2index->size()) {
             return std::string();
         }
         return std::string(_row[n]);
     }
 
     std::string operator[](std::string &&field_name) {
-        return GetValue(field_name);
+        return GetValue(StringView(field_name));
+    }
+
+    // a literal hashes at compile time; a char array is read up to its
+    // first NUL
+    template <size_t N>
+    std::string operator[](const char (&field_name)[N]) {
+        return GetValue(utils::ArrayKey(field_name));
+    }
+
+    // a char pointer, measured with strlen and hashed at runtime; 0 still
+    // picks the index overload
+    template <typename T, typename std::enable_if<std::is_same<T, const char*>::value ||
+                                                  std::is_same<T, char*>::value, int>::type = 0>
+    std::string operator[](T field_name) {
+        return (*this)[StringView(field_name)];
+    }
+
+    std::string operator[](StringView field_name) {
+        return GetValue(utils::HashedKey(field_name, utils::Hash64(field_name.data(), field_name.size())));
     }
 
-    std::string operator[](const char* field_name) {
+    std::string operator[](const utils::HashedKey& field_name) {
         return GetValue(field_name);
     }
 
+    std::string operator[](utils::FieldHandle& field) {
+        if (!_field2index) {
+            return std::string();
+        }
+        return (*this)[field.resolve(*_field2index)];
+    }
+
 private:
-    std::string GetValue(const std::string& field_name) {
-        auto find = _field2index.find(field_name);
-        if (find == _field2index.end()) {
+    std::string GetValue(const utils::HashedKey& field_name) {
+        if (!_field2index) {
+            return std::string();
+        }
+        auto find = _field2index->find(field_name);
+        if (find == _field2index->end()) {
             return std::string();
         }
         return std::string(_row[find->second]);
     }
 private:
     MYSQL_ROW _row = nullptr;
-    const std::unordered_map<std::string, size_t> _field2index;
+    const utils::StringMap<size_t>* _field2index = nullptr;
 };
 
 class Result {
@@ -123,7 +155,7 @@ public:
 
 private:
     MYSQL_RES* _res;
-    std::unordered_map<std::string, size_t> _fields2index;
+    utils::StringMap<size_t> _fields2index;
 };
 
 struct ConnectInfo {
@@ -0,0 +1,241 @@
+#ifndef OUTPUT_STREAM_H
+#define OUTPUT_STREAM_H
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "stream.h"
+
+struct OutputOptions {
+    size_t max_iov = 64;                        // iovecs per writev, at most IOV_MAX
+    size_t max_write = 256 * 1024;              // bytes per writev
+    size_t high_watermark = 4 * 1024 * 1024;    // pending bytes that pause the writer
+    size_t low_watermark = 1024 * 1024;         // pending bytes that resume it
+    size_t copy_chunk = 4096;                   // chunk Copy fills without a pool
+};
+
+// Queue of outgoing bytes, the output counterpart of Stream. Slices and
+// adopted memory are queued by reference and written in place; Copy puts
+// small pieces such as frame headers into a shared chunk, and consecutive
+// copies become one iovec. Flush gathers up to max_iov entries or
+// max_write bytes per writev and repeats until the socket stops taking
+// data. Writable turns false once more than high_watermark bytes are
+// pending and true again when Flush brings them down to low_watermark, so
+// a producer facing a slow peer can stop instead of queueing without bound.
+class OutputStream {
+public:
+    explicit OutputStream(const OutputOptions &options = OutputOptions(), BufferPool *pool = nullptr)
+        : options_(options), pool_(pool) {
+        if (options_.max_iov == 0)
+            options_.max_iov = 1;
+        if (options_.max_iov > IOV_MAX)
+            options_.max_iov = IOV_MAX;
+        if (options_.max_write == 0)
+            options_.max_write = 1;
+        iov_.resize(options_.max_iov);
+    }
+
+    OutputStream(const OutputStream &) = delete;
+    OutputStream &operator=(const OutputStream &) = delete;
+
+    ~OutputStream() {
+        if (scratch_)
+            scratch_->Unref();
+    }
+
+    size_t GetPending() const {
+        return pending_;
+    }
+
+    bool Empty() const {
+        return pending_ == 0;
+    }
+
+    bool Writable() const {
+        return !paused_;
+    }
+
+    // queues the bytes of slice without copying, they stay referenced
+    // until written
+    void Write(const Slice &slice) {
+        if (slice.empty())
+            return;
+        Push(Entry{slice, slice.data(), slice.size()});
+    }
+
+    // queues caller memory, release(data, size, ctx) runs once it is written
+    // or the stream is destroyed
+    void Write(char *data, size_t size, BufferRelease release, void *ctx = nullptr) {
+        if (size == 0) {
+            release(data, size, ctx);
+            return;
+        }
+        Buffer *p = new Buffer(data, size, release, ctx);
+        Push(Entry{Slice(p, data, size), data, size});
+        p->Unref();
+    }
+
+    // copies data, appending to the previous copy's iovec when they are
+    // adjacent
+    void Copy(const void *data, size_t size) {
+        if (size == 0)
+            return;
+        if (!scratch_ || scratch_->GetSpace() < size) {
+            if (size > ScratchSize()) {
+                Buffer *p = new Buffer(size, static_cast<char *>(const_cast<void *>(data)));
+                Push(Entry{Slice(p, p->data, size), p->data, size});
+                p->Unref();
+                return;
+            }
+            NextScratch();
+        }
+        char *dst = scratch_->limit;
+        memcpy(dst, data, size);
+        scratch_->limit += size;
+        if (!entries_.empty() && entries_.back().owner.buffer() == scratch_ &&
+            entries_.back().data + entries_.back().size == dst) {
+            entries_.back().size += size;
+            Grow(size);
+            return;
+        }
+        Push(Entry{Slice(scratch_, dst, size), dst, size});
+    }
+
+    // a length-prefixed frame: the header is copied, the payload queued by
+    // reference
+    void WriteFrame(FrameHeader header, const Slice &payload) {
+        uint8_t buf[kMaxFrameHeader];
+        Copy(buf, EncodeFrameHeader(header, payload.size(), buf));
+        Write(payload);
+    }
+
+    // a small frame copied whole, header and body in one iovec
+    void WriteFrame(FrameHeader header, const void *data, size_t size) {
+        uint8_t buf[kMaxFrameHeader];
+        Copy(buf, EncodeFrameHeader(header, size, buf));
+        Copy(data, size);
+    }
+
+    // Writes pending bytes to fd until they run out or the socket would
+    // block. Returns false on a write error, with errno set; EAGAIN is not
+    // one. Sockets are written with MSG_NOSIGNAL, so a closed peer gives
+    // EPIPE rather than SIGPIPE.
+    bool Flush(int fd) {
+        while (head_ < entries_.size()) {
+            size_t count = 0, bytes = 0;
+            for (size_t i = head_; i < entries_.size() && count < iov_.size() && bytes < options_.max_write; i++) {
+                size_t len = entries_[i].size;
+                if (len > options_.max_write - bytes)
+                    len = options_.max_write - bytes;
+                iov_[count].iov_base = const_cast<char *>(entries_[i].data);
+                iov_[count].iov_len = len;
+                count++;
+                bytes += len;
+            }
+            ssize_t n = Send(fd, iov_.data(), count);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            Consume(static_cast<size_t>(n));
+            // a short write filled the socket buffer, wait for it to drain
+            if (static_cast<size_t>(n) < bytes)
+                return true;
+        }
+        return true;
+    }
+
+    // drops everything still queued
+    void Clear() {
+        entries_.clear();
+        head_ = 0;
+        pending_ = 0;
+        paused_ = false;
+    }
+
+private:
+    struct Entry {
+        Slice owner;        // keeps the bytes alive
+        const char *data;   // first unwritten byte
+        size_t size;
+    };
+
+    static ssize_t Send(int fd, iovec *iov, size_t count) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = writev(fd, iov, static_cast<int>(count));
+        return n;
+    }
+
+    size_t ScratchSize() const {
+        return pool_ ? pool_->chunk_size() : options_.copy_chunk;
+    }
+
+    // starts over in the current chunk once nothing queued points into it
+    void NextScratch() {
+        if (scratch_ && scratch_->refs.load(std::memory_order_acquire) == 1) {
+            scratch_->pos = scratch_->limit = scratch_->data;
+            return;
+        }
+        if (scratch_)
+            scratch_->Unref();
+        scratch_ = pool_ ? pool_->Get() : Buffer::Chunk(options_.copy_chunk);
+    }
+
+    void Push(Entry entry) {
+        size_t size = entry.size;
+        entries_.push_back(std::move(entry));
+        Grow(size);
+    }
+
+    void Grow(size_t size) {
+        pending_ += size;
+        if (pending_ > options_.high_watermark)
+            paused_ = true;
+    }
+
+    void Consume(size_t size) {
+        pending_ -= size;
+        while (size) {
+            Entry &entry = entries_[head_];
+            if (size < entry.size) {
+                entry.data += size;
+                entry.size -= size;
+                break;
+            }
+            size -= entry.size;
+            entry.owner = Slice();
+            head_++;
+        }
+        if (head_ == entries_.size()) {
+            entries_.clear();
+            head_ = 0;
+        } else if (head_ >= 1024 && head_ * 2 >= entries_.size()) {
+            entries_.erase(entries_.begin(), entries_.begin() + head_);
+            head_ = 0;
+        }
+        if (paused_ && pending_ <= options_.low_watermark)
+            paused_ = false;
+    }
+
+    OutputOptions options_;
+    BufferPool *pool_;
+    Buffer *scratch_ = nullptr;     // chunk Copy appends to
+    std::vector<Entry> entries_;    // written from head_ on
+    size_t head_ = 0;
+    size_t pending_ = 0;
+    bool paused_ = false;
+    std::vector<iovec> iov_;
+};
+
+#endif // OUTPUT_STREAM_H
@@ -0,0 +1,230 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace utils {
+static constexpr size_t kCacheLine = 64;
+
+inline size_t RoundUpPowerOfTwo(size_t n) {
+    size_t p = 2;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// Bounded lock-free ring for one producer and one consumer thread, e.g. an
+// I/O thread handing Slices or Buffer chunks to a parser thread; Stream
+// itself stays single-threaded. The capacity is rounded up to a power of
+// two. Each side keeps its index on its own cache line next to a cached
+// copy of the other side's, so it only touches the shared line when the
+// ring looks full or empty. T must be default constructible; popped slots
+// are left moved-from.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : mask_(RoundUpPowerOfTwo(capacity) - 1), slots_(new T[mask_ + 1]) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side
+    bool push(T value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // moves up to count items in with one release, returns how many fit
+    size_t push_batch(T* items, size_t count) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t room = mask_ + 1 - (tail - head_cache_);
+        if (room < count) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            room = mask_ + 1 - (tail - head_cache_);
+        }
+        if (count > room) {
+            count = room;
+        }
+        for (size_t i = 0; i < count; i++) {
+            slots_[(tail + i) & mask_] = std::move(items[i]);
+        }
+        if (count) {
+            tail_.store(tail + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // consumer side
+    bool pop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // moves up to max items out with one release, returns how many
+    size_t pop_batch(T* out, size_t max) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t count = tail_cache_ - head;
+        if (count < max) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            count = tail_cache_ - head;
+        }
+        if (count > max) {
+            count = max;
+        }
+        for (size_t i = 0; i < count; i++) {
+            out[i] = std::move(slots_[(head + i) & mask_]);
+        }
+        if (count) {
+            head_.store(head + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // a snapshot, exact only on a quiet queue
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    const size_t mask_;
+    const std::unique_ptr<T[]> slots_;
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;     // consumer's view of tail_
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;     // producer's view of head_
+};
+
+// Bounded lock-free queue for many producer threads and one consumer.
+// Producers claim consecutive slots with a CAS on the tail and publish each
+// one through its sequence number, so the consumer takes items in claim
+// order and stops at the first slot still being written. A batch is claimed
+// with a single CAS. T must be default constructible.
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity)
+        : mask_(RoundUpPowerOfTwo(capacity) - 1), cells_(new Cell[mask_ + 1]) {}
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // producer side, any thread
+    bool push(T value) {
+        size_t tail;
+        if (claim(1, tail) == 0) {
+            return false;
+        }
+        publish(tail, value);
+        return true;
+    }
+
+    // moves up to count items in with one claim, returns how many fit
+    size_t push_batch(T* items, size_t count) {
+        size_t tail;
+        count = claim(count, tail);
+        for (size_t i = 0; i < count; i++) {
+            publish(tail + i, items[i]);
+        }
+        return count;
+    }
+
+    // consumer side, one thread
+    bool pop(T& value) {
+        return pop_batch(&value, 1) == 1;
+    }
+
+    // moves out up to max published items, returns how many
+    size_t pop_batch(T* out, size_t max) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < max) {
+            Cell& cell = cells_[(head + count) & mask_];
+            if (cell.seq.load(std::memory_order_acquire) != head + count + 1) {
+                break;
+            }
+            out[count] = std::move(cell.value);
+            count++;
+        }
+        if (count) {
+            head_.store(head + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // a snapshot, exact only on a quiet queue
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq{0};     // slot position + 1 once published
+        T value;
+    };
+
+    // reserves up to count slots below head_ + capacity
+    size_t claim(size_t count, size_t& tail) {
+        tail = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            size_t room = mask_ + 1 - (tail - head_.load(std::memory_order_acquire));
+            size_t n = count < room ? count : room;
+            if (n == 0) {
+                return 0;
+            }
+            if (tail_.compare_exchange_weak(tail, tail + n, std::memory_order_relaxed)) {
+                return n;
+            }
+        }
+    }
+
+    void publish(size_t pos, T& value) {
+        Cell& cell = cells_[pos & mask_];
+        cell.value = std::move(value);
+        cell.seq.store(pos + 1, std::memory_order_release);
+    }
+
+    const size_t mask_;
+    const std::unique_ptr<Cell[]> cells_;
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+};
+}
+
+#endif // QUEUE_H
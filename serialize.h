@@ -0,0 +1,669 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "byte_order.h"
+#include "stream.h"
+#include "string_view.h"
+
+// Tagged binary encoding in the protobuf wire format. A struct is described
+// by specializing utils::Schema with a fields() template that hands every
+// member and its tag to a visitor:
+//
+//     namespace utils {
+//     template <>
+//     struct Schema<Order> {
+//         template <typename Visitor, typename O>
+//         static void fields(Visitor &v, O &o) {
+//             v.field(1, o.id);                   // unsigned: varint
+//             v.field(2, o.quantity);             // signed: zigzag varint
+//             v.field(3, Fixed(o.price_ticks));
+//             v.field(4, o.symbol);               // length-prefixed
+//             v.field(5, o.fills);                // packed vector
+//         }
+//     };
+//     }
+//
+// Every field is written as a varint key (tag << 3 | wire type) and its
+// value, so decoders skip tags they do not know and leave members the
+// encoder did not send untouched; tags may be added but never reused.
+// Fields are decoded in one pass when they arrive in tag order, as Encode
+// writes them with ascending tags, and matched one by one otherwise.
+namespace utils {
+enum class WireType : uint8_t {
+    kVarint = 0,
+    kFixed64 = 1,
+    kLengthDelimited = 2,
+    kFixed32 = 5,
+};
+
+template <typename T>
+struct Schema;
+
+inline size_t VarintSize(uint64_t v) {
+    // ceil(bits / 7) without a division, zero takes one byte
+    return static_cast<size_t>((64 - __builtin_clzll(v | 1)) * 9 + 64) / 64;
+}
+
+inline uint64_t ZigzagEncode(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t ZigzagDecode(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Growable contiguous output, doubling as needed. The bytes may be handed
+// to Stream::Adopt with release() and a free() callback.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t capacity = 256) {
+        reserve(capacity);
+    }
+
+    ~OutputBuffer() {
+        free(data_);
+    }
+
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    char *data() {
+        return data_;
+    }
+
+    const char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    StringView view() const {
+        return StringView(data_, size_);
+    }
+
+    void clear() {
+        size_ = 0;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= capacity_)
+            return;
+        char *p = static_cast<char *>(realloc(data_, capacity));
+        if (!p)
+            throw std::bad_alloc();
+        data_ = p;
+        capacity_ = capacity;
+    }
+
+    // room for n more bytes, made part of the output by commit(n)
+    char *ensure(size_t n) {
+        if (capacity_ - size_ < n)
+            reserve(capacity_ * 2 > size_ + n ? capacity_ * 2 : size_ + n);
+        return data_ + size_;
+    }
+
+    void commit(size_t n) {
+        size_ += n;
+    }
+
+    void append(const void *src, size_t n) {
+        if (n) {
+            memcpy(ensure(n), src, n);
+            size_ += n;
+        }
+    }
+
+    void put_varint(uint64_t v) {
+        char *p = ensure(kMaxVarint);
+        size_ += EncodeVarint(v, reinterpret_cast<uint8_t *>(p));
+    }
+
+    // little-endian, the protobuf byte order
+    template <typename T>
+    void put_fixed(T v) {
+        StoreLE(ensure(sizeof(T)), v);
+        size_ += sizeof(T);
+    }
+
+    // gives up the malloc'ed bytes, the caller frees them
+    char *release() {
+        char *p = data_;
+        data_ = nullptr;
+        size_ = capacity_ = 0;
+        return p;
+    }
+
+private:
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+// Bounds-checked cursor over encoded bytes; a failed read leaves it at the
+// end so decoding stops.
+class Reader {
+public:
+    explicit Reader(StringView bytes)
+        : p_(reinterpret_cast<const uint8_t *>(bytes.data())), end_(p_ + bytes.size()) {}
+
+    bool done() const {
+        return p_ == end_;
+    }
+
+    bool varint(uint64_t &v) {
+        size_t n = DecodeVarint(p_, end_ - p_, v);
+        if (n == 0 || n > kMaxVarint)
+            return fail();
+        p_ += n;
+        return true;
+    }
+
+    template <typename T>
+    bool fixed(T &v) {
+        if (static_cast<size_t>(end_ - p_) < sizeof(T))
+            return fail();
+        v = LoadLE<T>(p_);
+        p_ += sizeof(T);
+        return true;
+    }
+
+    // a length-prefixed run of bytes, pointing into the input
+    bool bytes(StringView &v) {
+        uint64_t n;
+        if (!varint(n) || n > static_cast<uint64_t>(end_ - p_))
+            return fail();
+        v = StringView(reinterpret_cast<const char *>(p_), static_cast<size_t>(n));
+        p_ += n;
+        return true;
+    }
+
+    bool skip(WireType wire) {
+        uint64_t v;
+        StringView s;
+        switch (wire) {
+            case WireType::kVarint:
+                return varint(v);
+            case WireType::kFixed64:
+                return advance(8);
+            case WireType::kLengthDelimited:
+                return bytes(s);
+            case WireType::kFixed32:
+                return advance(4);
+        }
+        return fail();
+    }
+
+private:
+    bool advance(size_t n) {
+        if (static_cast<size_t>(end_ - p_) < n)
+            return fail();
+        p_ += n;
+        return true;
+    }
+
+    bool fail() {
+        p_ = end_;
+        return false;
+    }
+
+    const uint8_t *p_;
+    const uint8_t *end_;
+};
+
+// field wrappers choosing a non-default encoding: Fixed writes 4- and
+// 8-byte values as fixed32/fixed64, Varint writes signed values without
+// zigzag
+template <typename T>
+struct FixedField {
+    T &value;
+};
+
+template <typename T>
+struct VarintField {
+    T &value;
+};
+
+template <typename T>
+FixedField<T> Fixed(T &value) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "fixed fields are 4 or 8 bytes");
+    return FixedField<T>{value};
+}
+
+template <typename T>
+VarintField<T> Varint(T &value) {
+    static_assert(std::is_integral<T>::value, "varint fields are integers");
+    return VarintField<T>{value};
+}
+
+template <typename T>
+size_t EncodedSize(const T &value);
+
+template <typename T>
+void EncodeTo(const T &value, OutputBuffer &out);
+
+template <typename T>
+bool DecodeFrom(Reader &in, T &value);
+
+// How one value is sized, written and read. The primary template covers
+// structs with a Schema, nested as length-prefixed fields.
+template <typename T, typename Enable = void>
+struct Codec {
+    static constexpr WireType kWire = WireType::kLengthDelimited;
+
+    static size_t size(const T &v) {
+        size_t n = EncodedSize(v);
+        return VarintSize(n) + n;
+    }
+
+    static void encode(OutputBuffer &out, const T &v) {
+        out.put_varint(EncodedSize(v));
+        EncodeTo(v, out);
+    }
+
+    static bool decode(Reader &in, T &v) {
+        StringView s;
+        if (!in.bytes(s))
+            return false;
+        Reader fields(s);
+        return DecodeFrom(fields, v);
+    }
+};
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type> {
+    static constexpr WireType kWire = WireType::kVarint;
+
+    static size_t size(T v) {
+        return VarintSize(v);
+    }
+
+    static void encode(OutputBuffer &out, T v) {
+        out.put_varint(v);
+    }
+
+    static bool decode(Reader &in, T &v) {
+        uint64_t x;
+        if (!in.varint(x))
+            return false;
+        v = static_cast<T>(x);
+        return true;
+    }
+};
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+    static constexpr WireType kWire = WireType::kVarint;
+
+    static size_t size(T v) {
+        return VarintSize(ZigzagEncode(v));
+    }
+
+    static void encode(OutputBuffer &out, T v) {
+        out.put_varint(ZigzagEncode(v));
+    }
+
+    static bool decode(Reader &in, T &v) {
+        uint64_t x;
+        if (!in.varint(x))
+            return false;
+        v = static_cast<T>(ZigzagDecode(x));
+        return true;
+    }
+};
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8, "float or double");
+    static constexpr WireType kWire = sizeof(T) == 4 ? WireType::kFixed32 : WireType::kFixed64;
+
+    static size_t size(T) {
+        return sizeof(T);
+    }
+
+    static void encode(OutputBuffer &out, T v) {
+        out.put_fixed(v);
+    }
+
+    static bool decode(Reader &in, T &v) {
+        return in.fixed(v);
+    }
+};
+
+template <typename T>
+struct Codec<FixedField<T>> {
+    typedef typename std::remove_const<T>::type Value;
+    static constexpr WireType kWire = sizeof(T) == 4 ? WireType::kFixed32 : WireType::kFixed64;
+
+    static size_t size(const FixedField<T> &) {
+        return sizeof(T);
+    }
+
+    static void encode(OutputBuffer &out, const FixedField<T> &f) {
+        out.put_fixed<Value>(f.value);
+    }
+
+    static bool decode(Reader &in, const FixedField<T> &f) {
+        return in.fixed(f.value);
+    }
+};
+
+template <typename T>
+struct Codec<VarintField<T>> {
+    static constexpr WireType kWire = WireType::kVarint;
+
+    static size_t size(const VarintField<T> &f) {
+        return VarintSize(static_cast<uint64_t>(f.value));
+    }
+
+    static void encode(OutputBuffer &out, const VarintField<T> &f) {
+        out.put_varint(static_cast<uint64_t>(f.value));
+    }
+
+    static bool decode(Reader &in, const VarintField<T> &f) {
+        uint64_t x;
+        if (!in.varint(x))
+            return false;
+        f.value = static_cast<typename std::remove_const<T>::type>(x);
+        return true;
+    }
+};
+
+template <>
+struct Codec<std::string> {
+    static constexpr WireType kWire = WireType::kLengthDelimited;
+
+    static size_t size(const std::string &v) {
+        return VarintSize(v.size()) + v.size();
+    }
+
+    static void encode(OutputBuffer &out, const std::string &v) {
+        out.put_varint(v.size());
+        out.append(v.data(), v.size());
+    }
+
+    static bool decode(Reader &in, std::string &v) {
+        StringView s;
+        if (!in.bytes(s))
+            return false;
+        v.assign(s.data(), s.size());
+        return true;
+    }
+};
+
+// decodes without copying, the view points into the decoded bytes
+template <>
+struct Codec<StringView> {
+    static constexpr WireType kWire = WireType::kLengthDelimited;
+
+    static size_t size(const StringView &v) {
+        return VarintSize(v.size()) + v.size();
+    }
+
+    static void encode(OutputBuffer &out, const StringView &v) {
+        out.put_varint(v.size());
+        out.append(v.data(), v.size());
+    }
+
+    static bool decode(Reader &in, StringView &v) {
+        return in.bytes(v);
+    }
+};
+
+// vectors of numbers are packed into one length-prefixed field, vectors of
+// strings and structs repeat the field once per element
+template <typename T>
+struct Codec<std::vector<T>, typename std::enable_if<Codec<T>::kWire != WireType::kLengthDelimited>::type> {
+    static_assert(!std::is_same<T, bool>::value, "use std::vector<uint8_t>");
+    static constexpr WireType kWire = WireType::kLengthDelimited;
+
+    static size_t payload(const std::vector<T> &v) {
+        if (Codec<T>::kWire != WireType::kVarint)
+            return v.size() * sizeof(T);
+        size_t n = 0;
+        for (const T &x : v)
+            n += Codec<T>::size(x);
+        return n;
+    }
+
+    static size_t size(const std::vector<T> &v) {
+        size_t n = payload(v);
+        return VarintSize(n) + n;
+    }
+
+    static void encode(OutputBuffer &out, const std::vector<T> &v) {
+        size_t n = payload(v);
+        out.put_varint(n);
+        if (Codec<T>::kWire != WireType::kVarint && !IsBigEndianHost()) {
+            out.append(v.data(), n);
+            return;
+        }
+        out.ensure(n);
+        for (const T &x : v)
+            Codec<T>::encode(out, x);
+    }
+
+    // appends, so a vector sent in several fields is concatenated
+    static bool decode(Reader &in, std::vector<T> &v) {
+        StringView s;
+        if (!in.bytes(s))
+            return false;
+        if (Codec<T>::kWire != WireType::kVarint) {
+            if (s.size() % sizeof(T))
+                return false;
+            size_t old = v.size();
+            v.resize(old + s.size() / sizeof(T));
+            LoadLE(s.data(), v.data() + old, s.size() / sizeof(T));
+            return true;
+        }
+        Reader elements(s);
+        while (!elements.done()) {
+            T x;
+            if (!Codec<T>::decode(elements, x))
+                return false;
+            v.push_back(x);
+        }
+        return true;
+    }
+};
+
+template <typename T>
+struct IsRepeated : std::false_type {};
+
+template <typename T>
+struct IsRepeated<std::vector<T>>
+    : std::integral_constant<bool, Codec<T>::kWire == WireType::kLengthDelimited> {};
+
+inline uint64_t FieldKey(uint32_t tag, WireType wire) {
+    return static_cast<uint64_t>(tag) << 3 | static_cast<uint64_t>(wire);
+}
+
+// schema visitors
+class FieldSizer {
+public:
+    template <typename T>
+    void field(uint32_t tag, T &&value) {
+        add(tag, value, IsRepeated<typename std::decay<T>::type>());
+    }
+
+    size_t size = 0;
+
+private:
+    template <typename T>
+    void add(uint32_t tag, const T &value, std::false_type) {
+        typedef Codec<typename std::decay<T>::type> C;
+        size += VarintSize(FieldKey(tag, C::kWire)) + C::size(value);
+    }
+
+    template <typename T>
+    void add(uint32_t tag, const std::vector<T> &values, std::true_type) {
+        for (const T &v : values)
+            add(tag, v, std::false_type());
+    }
+};
+
+class FieldEncoder {
+public:
+    explicit FieldEncoder(OutputBuffer &out) : out_(out) {}
+
+    template <typename T>
+    void field(uint32_t tag, T &&value) {
+        put(tag, value, IsRepeated<typename std::decay<T>::type>());
+    }
+
+private:
+    template <typename T>
+    void put(uint32_t tag, const T &value, std::false_type) {
+        typedef Codec<typename std::decay<T>::type> C;
+        out_.put_varint(FieldKey(tag, C::kWire));
+        C::encode(out_, value);
+    }
+
+    template <typename T>
+    void put(uint32_t tag, const std::vector<T> &values, std::true_type) {
+        for (const T &v : values)
+            put(tag, v, std::false_type());
+    }
+
+    OutputBuffer &out_;
+};
+
+class FieldDecoder {
+public:
+    explicit FieldDecoder(Reader &in) : in_(in) {
+        next();
+    }
+
+    // the ordered pass takes the pending field when its tag comes up, the
+    // matching pass offers each pending field to every member in turn
+    template <typename T>
+    void field(uint32_t tag, T &&value) {
+        while (pending_ && tag_ == tag && ok_) {
+            ok_ = get(value, IsRepeated<typename std::decay<T>::type>());
+            matched_ = true;
+            if (ordered_)
+                next();
+            else
+                return;
+        }
+    }
+
+    // decodes the fields left after the ordered pass, skipping unknown tags
+    template <typename T>
+    bool finish(T &value) {
+        ordered_ = false;
+        while (ok_ && pending_) {
+            matched_ = false;
+            Schema<T>::fields(*this, value);
+            if (!matched_)
+                ok_ = in_.skip(wire_);
+            next();
+        }
+        return ok_;
+    }
+
+private:
+    void next() {
+        pending_ = false;
+        if (!ok_ || in_.done())
+            return;
+        uint64_t key;
+        if (!in_.varint(key) || (key & 7) == 3 || (key & 7) == 4 || (key & 7) > 5) {
+            ok_ = false;
+            return;
+        }
+        tag_ = static_cast<uint32_t>(key >> 3);
+        wire_ = static_cast<WireType>(key & 7);
+        pending_ = true;
+    }
+
+    template <typename T>
+    bool get(T &&value, std::false_type) {
+        typedef Codec<typename std::decay<T>::type> C;
+        return wire_ == C::kWire && C::decode(in_, value);
+    }
+
+    template <typename T>
+    bool get(std::vector<T> &values, std::true_type) {
+        values.emplace_back();
+        return get(values.back(), std::false_type());
+    }
+
+    Reader &in_;
+    uint32_t tag_ = 0;
+    WireType wire_ = WireType::kVarint;
+    bool pending_ = false;
+    bool matched_ = false;
+    bool ordered_ = true;
+    bool ok_ = true;
+};
+
+template <typename T>
+size_t EncodedSize(const T &value) {
+    FieldSizer sizer;
+    Schema<T>::fields(sizer, value);
+    return sizer.size;
+}
+
+template <typename T>
+void EncodeTo(const T &value, OutputBuffer &out) {
+    FieldEncoder encoder(out);
+    Schema<T>::fields(encoder, value);
+}
+
+template <typename T>
+bool DecodeFrom(Reader &in, T &value) {
+    FieldDecoder decoder(in);
+    Schema<T>::fields(decoder, value);
+    return decoder.finish(value);
+}
+
+// appends the encoding of value to out
+template <typename T>
+void Encode(const T &value, OutputBuffer &out) {
+    EncodeTo(value, out);
+}
+
+// appends a length-prefixed frame holding value, ready for Handler
+template <typename T>
+void EncodeFrame(const T &value, OutputBuffer &out, FrameHeader header = FrameHeader::kVarint) {
+    uint8_t prefix[kMaxFrameHeader];
+    out.append(prefix, EncodeFrameHeader(header, EncodedSize(value), prefix));
+    EncodeTo(value, out);
+}
+
+// decodes into value, whose members keep their contents for fields that
+// are not present; false on malformed input. StringView members point
+// into bytes.
+template <typename T>
+bool Decode(StringView bytes, T &value) {
+    Reader in(bytes);
+    return DecodeFrom(in, value);
+}
+
+// consumes size bytes of stream, copied only if they straddle buffers;
+// StringView members do not outlive the call
+template <typename T>
+bool Decode(Stream &stream, size_t size, T &value) {
+    if (stream.GetRemaining() < size)
+        return false;
+    Slice bytes = stream.GetSlice(size);
+    return Decode(bytes.view(), value);
+}
+}
+
+#endif // SERIALIZE_H
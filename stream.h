@@ -6,42 +6,100 @@
 #define STREAM_H
 
 #include <iostream>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
 
-template <typename T>
-T SwapEndian(T u)
-{
-    union
-    {
-        T u;
-        unsigned char u8[sizeof(T)];
-    } source, dest;
+#include "byte_order.h"
+#include "string_view.h"
 
-    source.u = u;
+constexpr size_t kMaxVarint = 10;
 
-    for (size_t k = 0; k < sizeof(T); k++)
-        dest.u8[k] = source.u8[sizeof(T) - k - 1];
+// writes v as an unsigned LEB128 varint, returns its length
+inline size_t EncodeVarint(uint64_t v, uint8_t *out) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
 
-    return dest.u;
+// reads a varint from the avail bytes at p, returns its length, 0 when it
+// runs past avail and kMaxVarint + 1 when it is longer than kMaxVarint
+inline size_t DecodeVarint(const uint8_t *p, size_t avail, uint64_t &v) {
+    v = 0;
+    for (size_t i = 0; i < kMaxVarint; i++) {
+        if (i == avail)
+            return 0;
+        v |= static_cast<uint64_t>(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80))
+            return i + 1;
+    }
+    return kMaxVarint + 1;
 }
 
+// frees memory handed to Stream::Adopt once nothing references it
+typedef void (*BufferRelease)(char *data, size_t size, void *ctx);
+
+class BufferPool;
+
+// A received chunk. Buffers are reference counted: the stream holds one
+// reference and every Slice over the chunk holds another, the memory is
+// released when the last one goes.
 struct Buffer {
-    Buffer(size_t size, char *src) {
+    explicit Buffer(size_t size) {
         data = new char[size + 1];
-        memcpy(data, src, size);
         data[size] = '\0';
         limit = data + size,
         pos = data;
+        end = limit;
     }
 
+    Buffer(size_t size, char *src) : Buffer(size) {
+        memcpy(data, src, size);
+    }
+
+    // adopts caller memory without copying
+    Buffer(char *src, size_t size, BufferRelease release, void *ctx)
+        : data(src), pos(src), limit(src + size), end(limit), release(release), ctx(ctx) {}
+
+    // an empty chunk with room for capacity bytes, filled through Stream::Prepare
+    static Buffer *Chunk(size_t capacity) {
+        Buffer *p = new Buffer(capacity);
+        p->limit = p->data;
+        return p;
+    }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
     ~Buffer() {
-        delete []data;
+        if (release)
+            release(data, limit - data, ctx);
+        else if (!pool)
+            delete []data;
     }
 
+    void Ref() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the last reference frees the buffer or hands a pooled chunk back
+    inline void Unref();
+
     inline size_t GetRemaining() {
         return limit - pos;
     }
 
+    inline size_t GetSpace() {
+        return end - limit;
+    }
+
     inline bool GetByte(uint8_t &b) {
         if (GetRemaining() == 0)
             return false;
@@ -59,83 +117,824 @@ struct Buffer {
     char *data;
     char *pos;
     char *limit;
+    char *end;      // end of the writable room after limit
     Buffer *next = nullptr;
+    BufferRelease release = nullptr;
+    void *ctx = nullptr;
+    BufferPool *pool = nullptr;     // owner of a pooled chunk
+    std::atomic<uint32_t> refs{1};
+
+private:
+    friend class BufferPool;
+
+    // a chunk whose data follows the header in the same block
+    Buffer(BufferPool *owner, size_t capacity) {
+        data = reinterpret_cast<char *>(this + 1);
+        data[capacity] = '\0';
+        pos = limit = data;
+        end = data + capacity;
+        pool = owner;
+    }
 };
 
-struct Stream {
-    size_t GetRemaining() {
-        Buffer *p = head;
-        size_t remaining = 0;
+// Recycles fixed-size chunks, header and data in one block, so streams that
+// share it stop allocating once enough chunks are in circulation. Chunks
+// are taken by one thread at a time, normally the one reading into the
+// streams, but the last reference may drop on any thread: returns go to a
+// lock-free list that Get takes over whole when its own list runs dry. At
+// most max_idle chunks are kept, the rest are freed. The pool must outlive
+// every stream and slice using it.
+class BufferPool {
+public:
+    explicit BufferPool(size_t chunk_size = 16 * 1024, size_t max_idle = 1024)
+        : chunk_size_(chunk_size), max_idle_(max_idle) {}
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    ~BufferPool() {
+        Free(local_);
+        Free(returned_.load(std::memory_order_acquire));
+    }
+
+    // an empty chunk of chunk_size bytes
+    Buffer *Get() {
+        if (!local_)
+            local_ = returned_.exchange(nullptr, std::memory_order_acquire);
+        if (local_) {
+            Buffer *p = local_;
+            local_ = p->next;
+            p->next = nullptr;
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            return p;
+        }
+        allocations_++;
+        return new(::operator new(sizeof(Buffer) + chunk_size_ + 1)) Buffer(this, chunk_size_);
+    }
+
+    size_t chunk_size() const {
+        return chunk_size_;
+    }
+
+    // chunks waiting for reuse
+    size_t idle() const {
+        return idle_.load(std::memory_order_relaxed);
+    }
+
+    // chunks allocated from the heap so far, flat in a steady state
+    size_t allocations() const {
+        return allocations_;
+    }
+
+private:
+    friend struct Buffer;
+
+    void Put(Buffer *p) {
+        if (idle_.fetch_add(1, std::memory_order_relaxed) >= max_idle_) {
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            Destroy(p);
+            return;
+        }
+        p->pos = p->limit = p->data;
+        p->refs.store(1, std::memory_order_relaxed);
+        p->next = returned_.load(std::memory_order_relaxed);
+        while (!returned_.compare_exchange_weak(p->next, p, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void Destroy(Buffer *p) {
+        p->~Buffer();
+        ::operator delete(p);
+    }
+
+    static void Free(Buffer *p) {
         while (p) {
-            remaining += p->GetRemaining();
-            p = p->next;
+            Buffer *next = p->next;
+            Destroy(p);
+            p = next;
+        }
+    }
+
+    const size_t chunk_size_;
+    const size_t max_idle_;
+    Buffer *local_ = nullptr;
+    std::atomic<Buffer *> returned_{nullptr};
+    std::atomic<size_t> idle_{0};
+    size_t allocations_ = 0;
+};
+
+inline void Buffer::Unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    if (pool)
+        pool->Put(this);
+    else
+        delete this;
+}
+
+// Read-only view of stream bytes that keeps its buffer alive, so it stays
+// valid after the stream has moved past it and may be handed to another
+// thread.
+class Slice {
+public:
+    Slice() = default;
+
+    // takes a reference on buffer
+    Slice(Buffer *buffer, const char *data, size_t size) : buffer_(buffer), data_(data), size_(size) {
+        buffer_->Ref();
+    }
+
+    Slice(const Slice &other) : buffer_(other.buffer_), data_(other.data_), size_(other.size_) {
+        if (buffer_)
+            buffer_->Ref();
+    }
+
+    Slice(Slice &&other) : buffer_(other.buffer_), data_(other.data_), size_(other.size_) {
+        other.buffer_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    Slice &operator=(Slice other) {
+        std::swap(buffer_, other.buffer_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~Slice() {
+        if (buffer_)
+            buffer_->Unref();
+    }
+
+    const char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    StringView view() const {
+        return StringView(data_, size_);
+    }
+
+    const Buffer *buffer() const {
+        return buffer_;
+    }
+
+    // a slice of other bytes of the same buffer
+    Slice Share(const char *data, size_t size) const {
+        return buffer_ ? Slice(buffer_, data, size) : Slice();
+    }
+
+private:
+    Buffer *buffer_ = nullptr;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Queue of received buffers. The byte count is kept up to date on every
+// Add and read, so GetRemaining is O(1), and reads release every buffer
+// they drain. Add copies the caller's bytes, Adopt takes the memory over,
+// and Prepare/Commit let a reader such as readv fill chunk space directly;
+// Front/Skip and GetSlice read without copying. With a BufferPool, Add and
+// Prepare fill pooled chunks, a payload longer than one spanning several.
+struct Stream {
+    struct Span {
+        char *data;
+        size_t size;
+    };
+
+    Stream() = default;
+    explicit Stream(BufferPool *pool) : pool(pool) {}
+    Stream(const Stream &) = delete;
+    Stream &operator=(const Stream &) = delete;
+
+    ~Stream() {
+        while (head) {
+            Buffer *p = head;
+            head = head->next;
+            p->Unref();
         }
+        if (spare)
+            spare->Unref();
+    }
+
+    size_t GetRemaining() const {
         return remaining;
     }
 
+    // copies data, first into the room left in the last chunk
     void Add(size_t size, char *data) {
-        Buffer *p = new Buffer(size, data);
-        if (!head)
-            head = p;
-        if (tail)
-            tail->next = p;
-        tail = p;
+        if (tail && tail->GetSpace()) {
+            size_t len = tail->GetSpace() < size ? tail->GetSpace() : size;
+            memcpy(tail->limit, data, len);
+            tail->limit += len;
+            remaining += len;
+            data += len;
+            size -= len;
+        }
+        if (size && !pool) {
+            Push(new Buffer(size, data));
+            return;
+        }
+        while (size) {
+            Buffer *p = spare ? spare : pool->Get();
+            spare = nullptr;
+            size_t len = p->GetSpace() < size ? p->GetSpace() : size;
+            memcpy(p->limit, data, len);
+            p->limit += len;
+            data += len;
+            size -= len;
+            Push(p);
+        }
+    }
+
+    // queues data in place, release(data, size, ctx) runs once the stream
+    // and every slice are done with it
+    void Adopt(char *data, size_t size, BufferRelease release, void *ctx = nullptr) {
+        if (size == 0) {
+            release(data, size, ctx);
+            return;
+        }
+        Push(new Buffer(data, size, release, ctx));
+    }
+
+    // tail room below which Prepare adds a spare chunk
+    static constexpr size_t kMinPrepareRoom = 4096;
+
+    // Writable room at the end of the stream: the free end of the last
+    // chunk, if any, then, when that is under kMinPrepareRoom, a spare
+    // chunk of chunk_size bytes, or of the pool's size. Fills spans, which
+    // must hold two entries, and returns how many it used.
+    size_t Prepare(Span *spans, size_t chunk_size) {
+        size_t n = 0;
+        if (tail && tail->GetSpace())
+            spans[n++] = Span{tail->limit, tail->GetSpace()};
+        if (n && tail->GetSpace() >= kMinPrepareRoom)
+            return n;
+        if (!spare)
+            spare = pool ? pool->Get() : Buffer::Chunk(chunk_size);
+        spans[n++] = Span{spare->limit, spare->GetSpace()};
+        return n;
+    }
+
+    // makes size bytes written into the prepared spans readable; a spare
+    // chunk the bytes did not reach is released, so an idle stream holds
+    // no more than its last chunk
+    void Commit(size_t size) {
+        if (tail && tail->GetSpace()) {
+            size_t len = tail->GetSpace() < size ? tail->GetSpace() : size;
+            tail->limit += len;
+            remaining += len;
+            size -= len;
+        }
+        if (size) {
+            spare->limit += size;
+            Push(spare);
+        } else if (spare) {
+            spare->Unref();
+        }
+        spare = nullptr;
+    }
+
+    // the unread bytes of the first buffer, valid until the next read
+    StringView Front() const {
+        return head ? StringView(head->pos, head->GetRemaining()) : StringView();
+    }
+
+    // copies up to size bytes without consuming them
+    size_t Peek(uint8_t *buf, size_t size) const {
+        size_t read = 0;
+        for (Buffer *p = head; p && read < size; p = p->next) {
+            size_t len = p->GetRemaining() < size - read ? p->GetRemaining() : size - read;
+            memcpy(buf + read, p->pos, len);
+            read += len;
+        }
+        return read;
+    }
+
+    size_t Skip(size_t size) {
+        size_t skipped = 0;
+        if (size > remaining)
+            size = remaining;
+        while (skipped < size) {
+            size_t len = head->GetRemaining() < size - skipped ? head->GetRemaining() : size - skipped;
+            head->pos += len;
+            skipped += len;
+            CleanBuffers();
+        }
+        remaining -= skipped;
+        return skipped;
+    }
+
+    // the next size bytes, shared with their buffer when they lie in one
+    // and copied into a buffer of their own when they straddle several;
+    // an empty slice when fewer bytes are queued
+    Slice GetSlice(size_t size) {
+        if (size == 0 || size > remaining)
+            return Slice();
+        if (head->GetRemaining() >= size) {
+            Slice slice(head, head->pos, size);
+            Skip(size);
+            return slice;
+        }
+        Buffer *joined;
+        if (pool && size <= pool->chunk_size()) {
+            joined = pool->Get();
+            joined->limit += size;
+        } else {
+            joined = new Buffer(size);
+        }
+        GetBytes(reinterpret_cast<uint8_t *>(joined->data), size);
+        Slice slice(joined, joined->data, size);
+        joined->Unref();
+        return slice;
     }
 
     bool GetByte(uint8_t &b) {
-        bool res = head->GetByte(b);
+        if (remaining == 0)
+            return false;
+        head->GetByte(b);
+        remaining--;
         CleanBuffers();
-        return res;
+        return true;
     }
 
     size_t GetBytes(uint8_t *buf, size_t size) {
-        Buffer *p = head;
         size_t read = 0;
-        while (p && read < size) {
-            read += p->GetBytes(buf + read , size - read);
-            p = p->next;
+        if (size > remaining)
+            size = remaining;
+        while (read < size) {
+            read += head->GetBytes(buf + read, size - read);
+            CleanBuffers();
         }
-        CleanBuffers();
+        remaining -= read;
         return read;
     }
 
+    // fixed-width values in big- or little-endian order, false without
+    // consuming anything when fewer than sizeof(T) bytes are queued
+    template <typename T>
+    bool GetBE(T &v) {
+        if (!GetValue(v))
+            return false;
+        if (!IsBigEndianHost())
+            v = SwapEndian(v);
+        return true;
+    }
+
+    template <typename T>
+    bool GetLE(T &v) {
+        if (!GetValue(v))
+            return false;
+        if (IsBigEndianHost())
+            v = SwapEndian(v);
+        return true;
+    }
+
+    // decodes up to count values straight out of the buffers, returns how
+    // many; only whole values are consumed
+    template <typename T>
+    size_t GetBE(T *out, size_t count) {
+        return GetArray(out, count, !IsBigEndianHost());
+    }
+
+    template <typename T>
+    size_t GetLE(T *out, size_t count) {
+        return GetArray(out, count, IsBigEndianHost());
+    }
+
+    // false without consuming anything when the varint is incomplete or
+    // longer than kMaxVarint bytes
+    bool GetVarint(uint64_t &v) {
+        uint8_t bytes[kMaxVarint];
+        const uint8_t *p = bytes;
+        size_t avail = head ? head->GetRemaining() : 0;
+        if (avail >= kMaxVarint || avail == remaining)
+            p = reinterpret_cast<const uint8_t *>(head ? head->pos : nullptr);
+        else
+            avail = Peek(bytes, kMaxVarint);
+        size_t n = DecodeVarint(p, avail, v);
+        if (n == 0 || n > kMaxVarint)
+            return false;
+        Skip(n);
+        return true;
+    }
+
+    // appends values in big- or little-endian order
+    template <typename T>
+    void PutBE(T v) {
+        StoreBE(Reserve(sizeof(T)), v);
+        Produce(sizeof(T));
+    }
+
+    template <typename T>
+    void PutLE(T v) {
+        StoreLE(Reserve(sizeof(T)), v);
+        Produce(sizeof(T));
+    }
+
+    template <typename T>
+    void PutBE(const T *values, size_t count) {
+        PutArray(values, count, !IsBigEndianHost());
+    }
+
+    template <typename T>
+    void PutLE(const T *values, size_t count) {
+        PutArray(values, count, IsBigEndianHost());
+    }
+
+    void PutVarint(uint64_t v) {
+        Produce(EncodeVarint(v, reinterpret_cast<uint8_t *>(Reserve(kMaxVarint))));
+    }
+
+    // releases the fully consumed buffers at the front, except a last
+    // chunk that still has room for Prepare
     void CleanBuffers() {
-        if (head && head->GetRemaining() == 0) {
+        while (head && head->GetRemaining() == 0 && !(head == tail && head->GetSpace())) {
             Buffer *p = head;
             head = head->next;
             if (tail == p)
                 tail = nullptr;
-            delete p;
+            p->Unref();
         }
     }
 
+    void Push(Buffer *p) {
+        if (!head)
+            head = p;
+        if (tail)
+            tail->next = p;
+        tail = p;
+        remaining += p->GetRemaining();
+        CleanBuffers();     // an emptied chunk kept for Prepare is no longer last
+    }
+
+private:
+    // chunk size Put uses without a pool
+    static constexpr size_t kPutChunkSize = 4096;
+
+    template <typename T>
+    bool GetValue(T &v) {
+        if (remaining < sizeof(T))
+            return false;
+        if (head->GetRemaining() >= sizeof(T)) {
+            memcpy(&v, head->pos, sizeof(T));
+            head->pos += sizeof(T);
+            remaining -= sizeof(T);
+            CleanBuffers();
+        } else {
+            GetBytes(reinterpret_cast<uint8_t *>(&v), sizeof(T));
+        }
+        return true;
+    }
+
+    template <typename T>
+    size_t GetArray(T *out, size_t count, bool swap) {
+        if (count > remaining / sizeof(T))
+            count = remaining / sizeof(T);
+        size_t done = 0;
+        while (done < count) {
+            size_t n = head->GetRemaining() / sizeof(T);
+            if (n == 0) {
+                // a value straddling two buffers
+                GetBytes(reinterpret_cast<uint8_t *>(out + done), sizeof(T));
+                if (swap)
+                    out[done] = SwapEndian(out[done]);
+                done++;
+                continue;
+            }
+            if (n > count - done)
+                n = count - done;
+            if (swap)
+                SwapBytes<sizeof(T)>(head->pos, out + done, n);
+            else
+                memcpy(out + done, head->pos, n * sizeof(T));
+            head->pos += n * sizeof(T);
+            remaining -= n * sizeof(T);
+            done += n;
+            CleanBuffers();
+        }
+        return count;
+    }
+
+    template <typename T>
+    void PutArray(const T *values, size_t count, bool swap) {
+        while (count) {
+            Reserve(sizeof(T));
+            size_t n = tail->GetSpace() / sizeof(T);
+            if (n > count)
+                n = count;
+            if (swap)
+                SwapBytes<sizeof(T)>(values, tail->limit, n);
+            else
+                memcpy(tail->limit, values, n * sizeof(T));
+            Produce(n * sizeof(T));
+            values += n;
+            count -= n;
+        }
+    }
+
+    // room for at least size bytes at the end of the last chunk
+    char *Reserve(size_t size) {
+        if (!tail || tail->GetSpace() < size) {
+            Buffer *p = spare;
+            spare = nullptr;
+            if (!p || p->GetSpace() < size) {
+                if (p)
+                    p->Unref();
+                p = pool && size <= pool->chunk_size() ? pool->Get()
+                        : Buffer::Chunk(size > kPutChunkSize ? size : kPutChunkSize);
+            }
+            Push(p);
+        }
+        return tail->limit;
+    }
+
+    void Produce(size_t size) {
+        tail->limit += size;
+        remaining += size;
+    }
+
+public:
     Buffer *head = nullptr;
     Buffer *tail = nullptr;
+    Buffer *spare = nullptr;    // chunk handed out by Prepare, not yet queued
+    size_t remaining = 0;
+    BufferPool *pool = nullptr;
+};
+
+enum class FrameHeader {
+    kU8,
+    kU16BE,
+    kU16LE,
+    kU32BE,
+    kU32LE,
+    kVarint,    // unsigned LEB128, up to 10 bytes
+};
+
+struct FrameOptions {
+    FrameHeader header = FrameHeader::kU8;
+    size_t max_frame_size = 16 * 1024 * 1024;
+};
+
+constexpr size_t kMaxFrameHeader = kMaxVarint;
+
+template <typename T>
+T LoadHeader(const uint8_t *p, bool big_endian) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return big_endian != IsBigEndianHost() ? SwapEndian(v) : v;
+}
+
+template <typename T>
+void StoreHeader(uint8_t *p, T v, bool big_endian) {
+    if (big_endian != IsBigEndianHost())
+        v = SwapEndian(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+// writes the length header for a frame of size bytes, returns its length
+inline size_t EncodeFrameHeader(FrameHeader header, uint64_t size, uint8_t *out) {
+    switch (header) {
+        case FrameHeader::kU8:
+            out[0] = static_cast<uint8_t>(size);
+            return 1;
+        case FrameHeader::kU16BE:
+        case FrameHeader::kU16LE:
+            StoreHeader(out, static_cast<uint16_t>(size), header == FrameHeader::kU16BE);
+            return 2;
+        case FrameHeader::kU32BE:
+        case FrameHeader::kU32LE:
+            StoreHeader(out, static_cast<uint32_t>(size), header == FrameHeader::kU32BE);
+            return 4;
+        case FrameHeader::kVarint:
+            break;
+    }
+    return EncodeVarint(size, out);
+}
+
+// Splits a Stream into length-prefixed frames. Each frame is returned as a
+// Slice over the queued data, copied only when it straddles two buffers.
+class FrameReader {
+public:
+    enum Status {
+        kFrame,         // frame holds the next frame
+        kNeedMore,      // the stream ends inside a frame
+        kTooLarge,      // the header announces more than max_frame_size
+        kBadHeader,     // a varint longer than 10 bytes
+    };
+
+    explicit FrameReader(const FrameOptions &options = FrameOptions()) : options_(options) {}
+
+    const FrameOptions &options() const {
+        return options_;
+    }
+
+    // errors are sticky: the stream is left at the offending header
+    Status Next(Stream &stream, Slice &frame) {
+        size_t header = 0, size = 0;
+        Status status = Peek(stream, header, size);
+        if (status != kFrame)
+            return status;
+        stream.Skip(header);
+        frame = stream.GetSlice(size);
+        return kFrame;
+    }
+
+    // decodes the next header without consuming anything; kFrame means the
+    // header and all size payload bytes are queued
+    Status Peek(const Stream &stream, size_t &header, size_t &size) const {
+        uint8_t bytes[kMaxFrameHeader];
+        const uint8_t *p = bytes;
+        size_t avail = stream.Front().size();
+        if (avail >= kMaxFrameHeader || avail == stream.GetRemaining()) {
+            p = reinterpret_cast<const uint8_t *>(stream.Front().data());
+        } else {
+            avail = stream.Peek(bytes, kMaxFrameHeader);
+        }
+
+        uint64_t length = 0;
+        Status status = ParseHeader(p, avail, length, header);
+        if (status != kFrame)
+            return status;
+        if (length > options_.max_frame_size)
+            return kTooLarge;
+        if (stream.GetRemaining() - header < length)
+            return kNeedMore;
+        size = static_cast<size_t>(length);
+        return kFrame;
+    }
+
+private:
+    Status ParseHeader(const uint8_t *p, size_t avail, uint64_t &size, size_t &header) const {
+        switch (options_.header) {
+            case FrameHeader::kU8:
+                header = 1;
+                if (avail < header)
+                    return kNeedMore;
+                size = p[0];
+                return kFrame;
+            case FrameHeader::kU16BE:
+            case FrameHeader::kU16LE:
+                header = 2;
+                if (avail < header)
+                    return kNeedMore;
+                size = LoadHeader<uint16_t>(p, options_.header == FrameHeader::kU16BE);
+                return kFrame;
+            case FrameHeader::kU32BE:
+            case FrameHeader::kU32LE:
+                header = 4;
+                if (avail < header)
+                    return kNeedMore;
+                size = LoadHeader<uint32_t>(p, options_.header == FrameHeader::kU32BE);
+                return kFrame;
+            case FrameHeader::kVarint:
+                break;
+        }
+        header = DecodeVarint(p, avail, size);
+        if (header == 0)
+            return kNeedMore;
+        return header > kMaxVarint ? kBadHeader : kFrame;
+    }
+
+    FrameOptions options_;
+};
+
+// A frame split into its opcode byte and body. The body is only valid
+// during the handler call, Retain() keeps it alive beyond that.
+struct Frame {
+    Slice Retain() const {
+        return empty ? Slice() : owner->Share(body.data() - 1, body.size() + 1);
+    }
+
+    uint8_t opcode;
+    bool empty;         // a zero-length frame, without opcode
+    StringView body;
+    const Slice *owner;
+};
+
+typedef void (*FrameFn)(void *ctx, const Frame &frame);
+typedef void (*FrameBatchFn)(void *ctx, const Frame *frames, size_t count);
+
+// Routes frames to handlers by their first byte through a flat table of
+// function pointers. A batch handler receives each run of consecutive
+// frames with its opcode in one call, so frame order is kept.
+class FrameDispatcher {
+public:
+    void On(uint8_t opcode, FrameFn fn, void *ctx = nullptr) {
+        table_[opcode] = Route{fn, nullptr, ctx};
+    }
+
+    void OnBatch(uint8_t opcode, FrameBatchFn fn, void *ctx = nullptr) {
+        table_[opcode] = Route{nullptr, fn, ctx};
+    }
+
+    // empty frames and opcodes without a handler, dropped by default
+    void OnUnknown(FrameFn fn, void *ctx = nullptr) {
+        unknown_ = Route{fn, nullptr, ctx};
+    }
+
+    void Dispatch(const Frame *frames, size_t count) const {
+        for (size_t i = 0; i < count;) {
+            const Route &route = frames[i].empty ? unknown_ : table_[frames[i].opcode];
+            if (route.batch) {
+                size_t end = i + 1;
+                while (end < count && frames[end].opcode == frames[i].opcode && !frames[end].empty)
+                    end++;
+                route.batch(route.ctx, frames + i, end - i);
+                i = end;
+                continue;
+            }
+            const Route &single = route.fn ? route : unknown_;
+            if (single.fn)
+                single.fn(single.ctx, frames[i]);
+            i++;
+        }
+    }
+
+private:
+    struct Route {
+        FrameFn fn;
+        FrameBatchFn batch;
+        void *ctx;
+    };
+
+    Route table_[256] = {};
+    Route unknown_ = {};
 };
 
 class Handler {
 public:
-    Handler() {}
-    void ParseBuffers() {
+    // frames gathered per Dispatch round
+    static constexpr size_t kMaxBatch = 256;
+
+    explicit Handler(const FrameOptions &options = FrameOptions(), BufferPool *pool = nullptr)
+        : stream(pool), reader(options) {
+        batch_.reserve(kMaxBatch);
+        owners_.reserve(kMaxBatch);
+    }
+
+    // hands every complete frame to on_frame(const Slice &), returns the
+    // reader status that stopped parsing: kNeedMore or an error
+    template <typename F>
+    FrameReader::Status ParseBuffers(F &&on_frame) {
+        Slice frame;
         while (true) {
-            if (nextCommandSize == 0 && stream.GetRemaining() > sizeof(nextCommandSize)) {
-                stream.GetBytes(reinterpret_cast<uint8_t *>(&nextCommandSize), sizeof(nextCommandSize));
-            }
-            if (nextCommandSize && stream.GetRemaining() >= nextCommandSize) {
-                uint8_t command[nextCommandSize + 1];
-                stream.GetBytes(command, nextCommandSize);
-                command[nextCommandSize] = '\0';
-                printf("command = %s\n", std::string((char *)command).data());
-                nextCommandSize = 0;
-            } else {
-                break;
+            FrameReader::Status status = reader.Next(stream, frame);
+            if (status != FrameReader::kFrame)
+                return status;
+            on_frame(frame);
+        }
+    }
+
+    // parses the complete frames and routes them through dispatcher, up to
+    // kMaxBatch at a time so batch handlers see whole runs. Frames are read
+    // in place and share one reference per buffer instead of one each.
+    FrameReader::Status Dispatch() {
+        FrameReader::Status status = FrameReader::kFrame;
+        while (status == FrameReader::kFrame) {
+            size_t header = 0, size = 0;
+            while (batch_.size() < kMaxBatch && (status = reader.Peek(stream, header, size)) == FrameReader::kFrame) {
+                stream.Skip(header);
+                StringView data;
+                if (size && stream.head->GetRemaining() >= size) {
+                    if (owners_.empty() || owners_.back().buffer() != stream.head)
+                        owners_.push_back(Slice(stream.head, stream.head->data, 0));
+                    data = StringView(stream.head->pos, size);
+                    stream.Skip(size);
+                } else {
+                    owners_.push_back(stream.GetSlice(size));
+                    data = owners_.back().view();
+                }
+                Frame frame;
+                frame.empty = data.empty();
+                frame.opcode = frame.empty ? 0 : static_cast<uint8_t>(data[0]);
+                frame.body = frame.empty ? StringView() : StringView(data.data() + 1, data.size() - 1);
+                frame.owner = &owners_.back();
+                batch_.push_back(frame);
             }
+            dispatcher.Dispatch(batch_.data(), batch_.size());
+            batch_.clear();
+            owners_.clear();
         }
+        return status;
     }
 
 public:
     Stream stream;
-    uint8_t nextCommandSize = 0;
+    FrameReader reader;
+    FrameDispatcher dispatcher;
+
+private:
+    std::vector<Frame> batch_;
+    std::vector<Slice> owners_;     // at most one per frame, so never reallocated
 };
 
-#endif // STREAM_H
\ No newline at end of file
+#endif // STREAM_H
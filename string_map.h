@@ -0,0 +1,353 @@
+#ifndef STRING_MAP_H
+#define STRING_MAP_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <initializer_list>
+#include <atomic>
+
+#include "hash.h"
+#include "string_view.h"
+
+namespace utils {
+// drop-in hasher for std::unordered_map<std::string, ...>
+struct StringHash {
+    size_t operator()(const std::string& str) const noexcept {
+        return static_cast<size_t>(Hash64(str));
+    }
+
+    size_t operator()(StringView sv) const noexcept {
+        return static_cast<size_t>(Hash64(sv.data(), sv.size()));
+    }
+
+    size_t operator()(const char* str) const noexcept {
+        return static_cast<size_t>(Hash64(str));
+    }
+};
+
+// length of the string at p, stopping at max
+constexpr size_t ConstLength(const char* p, size_t max, size_t n = 0) {
+    return n < max && p[n] ? ConstLength(p, max, n + 1) : n;
+}
+
+// A key together with its hash. Built from a literal it hashes at compile
+// time; declare it constexpr (or use "name"_key in a constexpr) to force it.
+// An array is read up to its first NUL, so a char buffer works as well.
+struct HashedKey {
+    constexpr HashedKey(StringView k) : key(k), hash(ConstHash64(k.data(), k.size())) {}
+
+    template <size_t N>
+    constexpr HashedKey(const char (&k)[N]) : HashedKey(StringView(k, ConstLength(k, N))) {}
+
+    constexpr HashedKey(StringView k, uint64_t h) : key(k), hash(h) {}
+
+    StringView key;
+    uint64_t hash;
+};
+
+// HashedKey of a char array read up to its first NUL, for lookups outside
+// constant expressions: inlined over a literal, memchr and the hash fold
+// to constants at -O2, where the recursive ConstLength is left as a loop
+template <size_t N>
+inline HashedKey ArrayKey(const char (&k)[N]) {
+    const void* nul = memchr(k, 0, N);
+    return HashedKey(StringView(k, nul ? static_cast<const char*>(nul) - k : N));
+}
+
+// Open addressing map from std::string to V whose lookups accept
+// StringView, const char* or std::string without building a string.
+// Entries live densely in insertion order, the probe table only holds a
+// hash tag and an entry index, so iteration is a vector walk and a probe
+// touches one 8 byte slot until the tag matches.
+template <typename V>
+class StringMap {
+public:
+    using key_type = std::string;
+    using mapped_type = V;
+    using value_type = std::pair<std::string, V>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    StringMap() = default;
+    StringMap(const StringMap&) = default;
+    StringMap& operator=(const StringMap&) = default;
+
+    StringMap(StringMap&& other)
+        : entries_(std::move(other.entries_)), hashes_(std::move(other.hashes_)),
+          slots_(std::move(other.slots_)), version_(other.version_) {
+        other.clear();
+    }
+
+    StringMap& operator=(StringMap&& other) {
+        if (this != &other) {
+            entries_ = std::move(other.entries_);
+            hashes_ = std::move(other.hashes_);
+            slots_ = std::move(other.slots_);
+            version_ = other.version_;
+            other.clear();
+        }
+        return *this;
+    }
+
+    StringMap(std::initializer_list<value_type> init) {
+        reserve(init.size());
+        for (const auto& kv : init) {
+            (*this)[kv.first] = kv.second;
+        }
+    }
+
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    bool empty() const {
+        return entries_.empty();
+    }
+
+    void clear() {
+        entries_.clear();
+        hashes_.clear();
+        slots_.assign(slots_.size(), kEmpty);
+        version_ = NextVersion();
+    }
+
+    // changes whenever a key is added or removed; copies share it, so it
+    // identifies a key layout, see FieldHandle
+    uint64_t version() const {
+        return version_;
+    }
+
+    void reserve(size_t count) {
+        entries_.reserve(count);
+        hashes_.reserve(count);
+        size_t want = kMinSlots;
+        while (want * kMaxLoadNum < count * kMaxLoadDen) {
+            want <<= 1;
+        }
+        if (want > slots_.size()) {
+            rehash(want);
+        }
+    }
+
+    iterator find(StringView key) {
+        size_t index = lookup(key, utils::Hash64(key.data(), key.size()));
+        return index == kNotFound ? end() : begin() + index;
+    }
+
+    const_iterator find(StringView key) const {
+        size_t index = lookup(key, utils::Hash64(key.data(), key.size()));
+        return index == kNotFound ? end() : begin() + index;
+    }
+
+    const_iterator find(const HashedKey& key) const {
+        size_t index = lookup(key.key, key.hash);
+        return index == kNotFound ? end() : begin() + index;
+    }
+
+    iterator find(const std::string& key) { return find(StringView(key)); }
+    const_iterator find(const std::string& key) const { return find(StringView(key)); }
+    iterator find(const char* key) { return find(StringView(key)); }
+    const_iterator find(const char* key) const { return find(StringView(key)); }
+
+    size_t count(StringView key) const {
+        return find(key) == end() ? 0 : 1;
+    }
+
+    V& operator[](StringView key) {
+        uint64_t h = utils::Hash64(key.data(), key.size());
+        size_t index = lookup(key, h);
+        if (index == kNotFound) {
+            index = insert_new(key.ToString(), h);
+        }
+        return entries_[index].second;
+    }
+
+    V& operator[](const std::string& key) { return (*this)[StringView(key)]; }
+    V& operator[](const char* key) { return (*this)[StringView(key)]; }
+
+    V& operator[](std::string&& key) {
+        uint64_t h = utils::Hash64(key.data(), key.size());
+        size_t index = lookup(StringView(key), h);
+        if (index == kNotFound) {
+            index = insert_new(std::move(key), h);
+        }
+        return entries_[index].second;
+    }
+
+    size_t erase(StringView key) {
+        uint64_t h = utils::Hash64(key.data(), key.size());
+        size_t slot = find_slot(key, h);
+        if (slot == kNotFound) {
+            return 0;
+        }
+
+        size_t index = static_cast<uint32_t>(slots_[slot]) - 1;
+        remove_slot(slot);
+
+        // keep entries dense by moving the last one into the hole
+        size_t last = entries_.size() - 1;
+        if (index != last) {
+            size_t moved = find_slot(StringView(entries_[last].first), hashes_[last]);
+            slots_[moved] = make_slot(hashes_[last], index);
+            entries_[index] = std::move(entries_[last]);
+            hashes_[index] = hashes_[last];
+        }
+        entries_.pop_back();
+        hashes_.pop_back();
+        version_ = NextVersion();
+        return 1;
+    }
+
+private:
+    // a slot packs (upper 32 hash bits << 32 | entry index + 1), 0 is empty
+    static constexpr uint64_t kEmpty = 0;
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+    static constexpr size_t kMinSlots = 8;
+    static constexpr size_t kMaxLoadNum = 7;
+    static constexpr size_t kMaxLoadDen = 8;
+
+    static uint64_t make_slot(uint64_t h, size_t index) {
+        return (h & 0xffffffff00000000ull) | static_cast<uint64_t>(index + 1);
+    }
+
+    size_t find_slot(StringView key, uint64_t h) const {
+        if (slots_.empty()) {
+            return kNotFound;
+        }
+        const size_t mask = slots_.size() - 1;
+        const uint64_t tag = h & 0xffffffff00000000ull;
+        for (size_t i = static_cast<size_t>(h) & mask;; i = (i + 1) & mask) {
+            uint64_t slot = slots_[i];
+            if (slot == kEmpty) {
+                return kNotFound;
+            }
+            if ((slot & 0xffffffff00000000ull) == tag) {
+                const auto& k = entries_[static_cast<uint32_t>(slot) - 1].first;
+                if (k.size() == key.size() && memcmp(k.data(), key.data(), k.size()) == 0) {
+                    return i;
+                }
+            }
+        }
+    }
+
+    size_t lookup(StringView key, uint64_t h) const {
+        size_t slot = find_slot(key, h);
+        return slot == kNotFound ? kNotFound : static_cast<uint32_t>(slots_[slot]) - 1;
+    }
+
+    size_t insert_new(std::string&& key, uint64_t h) {
+        if ((entries_.size() + 1) * kMaxLoadDen > slots_.size() * kMaxLoadNum) {
+            rehash(slots_.empty() ? kMinSlots : slots_.size() * 2);
+        }
+        size_t index = entries_.size();
+        entries_.emplace_back(std::move(key), V());
+        hashes_.push_back(h);
+        place(make_slot(h, index), h);
+        version_ = NextVersion();
+        return index;
+    }
+
+    void place(uint64_t slot, uint64_t h) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = static_cast<size_t>(h) & mask;
+        while (slots_[i] != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = slot;
+    }
+
+    // backward shift deletion keeps probe chains intact without tombstones
+    void remove_slot(size_t hole) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = hole;
+        while (true) {
+            i = (i + 1) & mask;
+            uint64_t slot = slots_[i];
+            if (slot == kEmpty) {
+                break;
+            }
+            size_t home = static_cast<size_t>(hashes_[static_cast<uint32_t>(slot) - 1]) & mask;
+            // move back unless its home lies cyclically in (hole, i]
+            bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (!stays) {
+                slots_[hole] = slot;
+                hole = i;
+            }
+        }
+        slots_[hole] = kEmpty;
+    }
+
+    void rehash(size_t count) {
+        slots_.assign(count, kEmpty);
+        for (size_t index = 0; index < entries_.size(); index++) {
+            place(make_slot(hashes_[index], index), hashes_[index]);
+        }
+    }
+
+    std::vector<value_type> entries_;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint64_t> slots_;
+    uint64_t version_ = NextVersion();
+
+    static uint64_t NextVersion() {
+        static std::atomic<uint64_t> counter(0);
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+};
+
+template <typename V> constexpr uint64_t StringMap<V>::kEmpty;
+template <typename V> constexpr size_t StringMap<V>::kNotFound;
+template <typename V> constexpr size_t StringMap<V>::kMinSlots;
+template <typename V> constexpr size_t StringMap<V>::kMaxLoadNum;
+template <typename V> constexpr size_t StringMap<V>::kMaxLoadDen;
+
+// Column name bound to an index once per key layout: the first access
+// resolves the name, later accesses on rows sharing the same layout are
+// a version compare and an array index.
+class FieldHandle {
+public:
+    constexpr explicit FieldHandle(HashedKey name) : name_(name) {}
+
+    template <size_t N>
+    constexpr explicit FieldHandle(const char (&name)[N]) : name_(name) {}
+
+    StringView name() const {
+        return name_.key;
+    }
+
+    // returns kNotFound when the layout has no such column
+    size_t resolve(const StringMap<size_t>& layout) {
+        if (layout.version() != version_) {
+            auto find = layout.find(name_);
+            if (find == layout.end()) {
+                index_ = kNotFound;
+            } else {
+                index_ = find->second;
+            }
+            version_ = layout.version();
+        }
+        return index_;
+    }
+
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+private:
+    HashedKey name_;
+    uint64_t version_ = 0;
+    size_t index_ = kNotFound;
+};
+}
+
+constexpr utils::HashedKey operator"" _key(const char* str, size_t len) {
+    return utils::HashedKey(StringView(str, len));
+}
+
+#endif // STRING_MAP_H
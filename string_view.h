@@ -1,7 +1,19 @@
+#ifndef STRING_VIEW_H
+#define STRING_VIEW_H
+
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <cstring>
 #include <ostream>
+#include <string>
+#include <algorithm>
+
+#include "hash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 class StringView {
 public:
@@ -14,7 +26,7 @@ public:
     using difference_type = std::ptrdiff_t;
     using const_iterator = const char* ;
 
-    StringView() : StringView(nullptr, 0) {
+    constexpr StringView() : StringView(nullptr, 0) {
 
     }
 
@@ -28,49 +40,44 @@ public:
 
     }
 
-    explicit
-    StringView(std::string&& str) : StringView(str.data(), str.size()) {
-        
-    }
+    // a view of a temporary would dangle, intern it instead (intern.h)
+    StringView(std::string&& str) = delete;
 
-    StringView(const char* p, size_t len) : data_(p), len_(len) {
+    constexpr StringView(const char* p, size_t len) : data_(p), len_(len) {
 
     }
 
     StringView(const StringView& ) = default;
 
-    const_reference operator[](size_t index) const {
-        assert (index >= 0 && index < len_);
-        return data_[index];
+    constexpr const_reference operator[](size_t index) const {
+        return assert(index < len_), data_[index];
     }
 
-    const_pointer data() const {
+    constexpr const_pointer data() const {
         return data_;
     }
 
-    const_reference front() const {
-        assert(len_ > 0);
-        return data_[0];
+    constexpr const_reference front() const {
+        return assert(len_ > 0), data_[0];
     }
 
-    const_reference back() const {
-        assert (len_ > 0);
-        return data_[len_-1];
+    constexpr const_reference back() const {
+        return assert(len_ > 0), data_[len_-1];
     }
 
-    const_iterator begin() const {
+    constexpr const_iterator begin() const {
         return data_;
     }
 
-    const_iterator end() const {
+    constexpr const_iterator end() const {
         return data_ + len_;
     }
 
-    size_t size() const {
+    constexpr size_t size() const {
         return len_;
     }
 
-    bool empty() const {
+    constexpr bool empty() const {
         return len_ == 0;
     }
 
@@ -83,54 +90,22 @@ public:
         len_ -= n;
     }
 
-    size_t find(StringView v, size_t pos = 0) const {
-        if (pos > size()) {
-            return npos;
-        }
-
-        if ((pos + v.size()) > size()) {
-            return npos;
-        }
-
-        const auto offset = pos;
-        const auto increments = size() - v.size();
-
-        for (auto i = 0u; i <= increments; ++i) {
-            const auto j = i + offset;
-            if (compare(substr(i, v.size()), v)) {
-                return j;
-            }
-        }
-        return npos;
-    }
+    size_t find(StringView v, size_t pos = 0) const;
 
     size_t find(const char* s, size_t pos = 0) const {
         return find(StringView(s), pos);
     }
 
-    size_t rfind(StringView v, size_t pos = npos) const {
-        if (empty()) {
-            return v.empty() ? 0u : npos;
-        }
-
-        if (v.empty()) {
-            return std::min(size() - 1, pos);
-        }
-
-        if (v.size() > size()) {
+    size_t find(char c, size_t pos = 0) const {
+        if (pos >= size()) {
             return npos;
         }
-
-        auto i = std::min(pos, (size() - v.size()));
-        while (i != npos) {
-            if (compare(substr(i, v.size()), v)) {
-                return i;
-            }
-            --i;
-        }
-        return npos;
+        auto p = static_cast<const char*>(memchr(data_ + pos, c, size() - pos));
+        return p ? static_cast<size_t>(p - data_) : npos;
     }
 
+    size_t rfind(StringView v, size_t pos = npos) const;
+
     size_t rfind(const char* s, size_t pos = npos) const {
         return rfind(StringView(s), pos);
     }
@@ -143,7 +118,8 @@ public:
     }
 
     StringView substr(size_t pos = 0, size_t count = npos ) const {
-        return StringView(data_ + pos, std::min(count, size()));
+        assert(pos <= size());
+        return StringView(data_ + pos, std::min(count, size() - pos));
     }
 
     std::string ToString() const {
@@ -152,12 +128,12 @@ public:
 
     bool compare(const StringView& a, const StringView& b) const {
         return a.size() == b.size() &&
-               memcmp(a.data(), b.data(), a.size()) == 0;
+               (a.empty() || memcmp(a.data(), b.data(), a.size()) == 0);
     }
 
     bool compare(const StringView& b) const {
         return this->size() == b.size() &&
-               memcmp(this->data(), b.data(), this->size()) == 0;
+               (b.empty() || memcmp(this->data(), b.data(), this->size()) == 0);
     }
 
     bool compare(const char* b) const {
@@ -174,43 +150,259 @@ private:
     size_t len_;
 };
 
-bool operator==(const StringView& a, const StringView& b) {
+// Precompiled substring searcher, build once and reuse across haystacks.
+// Needles shorter than kShortNeedle are matched with a first/last byte
+// filter (SSE2 when available, memchr otherwise), longer ones with the
+// two-way algorithm, which is linear in the worst case.
+class Searcher {
+public:
+    static constexpr size_t kShortNeedle = 32;
+
+    explicit Searcher(StringView needle) : needle_(needle) {
+        if (needle_.size() >= kShortNeedle) {
+            compile();
+        }
+    }
+
+    StringView needle() const {
+        return needle_;
+    }
+
+    size_t find(StringView haystack, size_t pos = 0) const {
+        if (pos > haystack.size() || needle_.size() > haystack.size() - pos) {
+            return StringView::npos;
+        }
+        if (needle_.empty()) {
+            return pos;
+        }
+
+        auto h = reinterpret_cast<const unsigned char*>(haystack.data()) + pos;
+        auto n = haystack.size() - pos;
+        auto p = needle_.size() < kShortNeedle ? find_short(h, n) : find_two_way(h, n);
+        if (!p) {
+            return StringView::npos;
+        }
+        return static_cast<size_t>(reinterpret_cast<const char*>(p) - haystack.data());
+    }
+
+private:
+    const unsigned char* find_short(const unsigned char* h, size_t n) const {
+        auto s = reinterpret_cast<const unsigned char*>(needle_.data());
+        const size_t m = needle_.size();
+        const unsigned char first = s[0];
+        const unsigned char last = s[m - 1];
+        const unsigned char* end = h + n - m + 1; // one past the last candidate
+
+        const unsigned char* p = h;
+#if defined(__SSE2__)
+        const __m128i vfirst = _mm_set1_epi8(static_cast<char>(first));
+        const __m128i vlast = _mm_set1_epi8(static_cast<char>(last));
+        while (end - p >= 16) {
+            __m128i bf = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i bl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + m - 1));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(bf, vfirst), _mm_cmpeq_epi8(bl, vlast))));
+            while (mask) {
+                auto bit = __builtin_ctz(mask);
+                if (m <= 2 || memcmp(p + bit + 1, s + 1, m - 2) == 0) {
+                    return p + bit;
+                }
+                mask &= mask - 1;
+            }
+            p += 16;
+        }
+#endif
+        while (p < end) {
+            p = static_cast<const unsigned char*>(memchr(p, first, end - p));
+            if (!p) {
+                return nullptr;
+            }
+            if (p[m - 1] == last && memcmp(p, s, m) == 0) {
+                return p;
+            }
+            ++p;
+        }
+        return nullptr;
+    }
+
+    void compile() {
+        auto n = reinterpret_cast<const unsigned char*>(needle_.data());
+        const size_t l = needle_.size();
+
+        for (size_t i = 0; i < 256; i++) {
+            skip_[i] = l;
+        }
+        for (size_t i = 0; i < l; i++) {
+            skip_[n[i]] = l - i - 1;
+        }
+
+        // critical factorization: maximal suffix under both orderings
+        size_t p0 = 0;
+        size_t ms0 = maximal_suffix(n, l, false, p0);
+        size_t p1 = 0;
+        size_t ms1 = maximal_suffix(n, l, true, p1);
+        if (ms1 + 1 > ms0 + 1) {
+            ms_ = ms1;
+            period_ = p1;
+        } else {
+            ms_ = ms0;
+            period_ = p0;
+        }
+
+        if (memcmp(n, n + period_, ms_ + 1) != 0) {
+            memory_ = 0;
+            period_ = std::max(ms_, l - ms_ - 1) + 1;
+        } else {
+            memory_ = l - period_;
+        }
+    }
+
+    // returns the start of the maximal suffix minus one (npos when it is
+    // the whole needle) and its period through `period`
+    static size_t maximal_suffix(const unsigned char* n, size_t l, bool reverse, size_t& period) {
+        size_t ip = StringView::npos;
+        size_t jp = 0;
+        size_t k = 1;
+        size_t p = 1;
+        while (jp + k < l) {
+            auto a = n[ip + k];
+            auto b = n[jp + k];
+            if (a == b) {
+                if (k == p) {
+                    jp += p;
+                    k = 1;
+                } else {
+                    k++;
+                }
+            } else if (reverse ? a < b : a > b) {
+                jp += k;
+                k = 1;
+                p = jp - ip;
+            } else {
+                ip = jp++;
+                k = p = 1;
+            }
+        }
+        period = p;
+        return ip;
+    }
+
+    const unsigned char* find_two_way(const unsigned char* h, size_t n) const {
+        auto s = reinterpret_cast<const unsigned char*>(needle_.data());
+        const size_t l = needle_.size();
+        const unsigned char* z = h + n;
+        size_t mem = 0;
+
+        while (static_cast<size_t>(z - h) >= l) {
+            size_t k = skip_[h[l - 1]];
+            if (k) {
+                h += std::max(k, mem);
+                mem = 0;
+                continue;
+            }
+
+            // right half
+            for (k = std::max(ms_ + 1, mem); k < l && s[k] == h[k]; k++);
+            if (k < l) {
+                h += k - ms_;
+                mem = 0;
+                continue;
+            }
+            // left half
+            for (k = ms_ + 1; k > mem && s[k - 1] == h[k - 1]; k--);
+            if (k <= mem) {
+                return h;
+            }
+            h += period_;
+            mem = memory_;
+        }
+        return nullptr;
+    }
+
+    StringView needle_;
+    size_t ms_ = 0;
+    size_t period_ = 0;
+    size_t memory_ = 0;
+    size_t skip_[256];
+};
+
+inline size_t StringView::find(StringView v, size_t pos) const {
+    if (pos > size() || v.size() > size() - pos) {
+        return npos;
+    }
+    if (v.size() == 1) {
+        return find(v[0], pos);
+    }
+    return Searcher(v).find(*this, pos);
+}
+
+inline size_t StringView::rfind(StringView v, size_t pos) const {
+    if (v.size() > size()) {
+        return npos;
+    }
+
+    auto i = std::min(pos, size() - v.size());
+    if (v.empty()) {
+        return i;
+    }
+
+    const char first = v.front();
+    const char last = v.back();
+    const size_t m = v.size();
+    while (true) {
+        if (data_[i] == first && data_[i + m - 1] == last &&
+            memcmp(data_ + i, v.data(), m) == 0) {
+            return i;
+        }
+        if (i == 0) {
+            break;
+        }
+        --i;
+    }
+    return npos;
+}
+
+constexpr StringView operator"" _sv(const char* str, size_t len) {
+    return StringView(str, len);
+}
+
+inline bool operator==(const StringView& a, const StringView& b) {
     return a.compare(b);
 }
 
-bool operator==(const StringView& a, const char* b) {
+inline bool operator==(const StringView& a, const char* b) {
     return a.compare(b);
 }
 
-bool operator==(const char*& a, const StringView& b) {
+inline bool operator==(const char*& a, const StringView& b) {
     return b == a;
 }
 
-bool operator!=(const StringView& a, const StringView& b) {
+inline bool operator!=(const StringView& a, const StringView& b) {
     return !(a == b);
 }
 
-bool operator<(const StringView& a, const StringView& b) {
+inline bool operator<(const StringView& a, const StringView& b) {
     if (a.size() < b.size()) {
         return a.size() == 0 || memcmp(a.data(), b.data(), a.size()) <= 0;
     } 
     return memcmp(a.data(), b.data(), b.size()) < 0;
 }
 
-bool operator>(const StringView& a, const StringView& b) {
+inline bool operator>(const StringView& a, const StringView& b) {
     return !(a<b || a==b);
 }
 
-bool operator<=(const StringView& a, const StringView& b) {
+inline bool operator<=(const StringView& a, const StringView& b) {
     return !(a > b);
 }
 
-bool operator>=(const StringView& a, const StringView& b) {
+inline bool operator>=(const StringView& a, const StringView& b) {
     return !(a < b);
 }
 
 inline std::ostream& operator<< (std::ostream& os, const StringView& sv) {
-    return os << sv.data();
+    return os.write(sv.data(), sv.size());
 }
 namespace std {
 template<>
@@ -218,11 +410,9 @@ struct hash<StringView> {
     typedef StringView argument_type;
     typedef std::size_t result_type;
     result_type operator()(const argument_type& sv) const noexcept {
-        std::size_t result = 0;
-        for (auto ch : sv) {
-            result = (result * 131) + ch;
-        }
-        return result;
+        return static_cast<result_type>(utils::Hash64(sv.data(), sv.size()));
     }
 };
-}
\ No newline at end of file
+}
+
+#endif // STRING_VIEW_H
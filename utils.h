@@ -9,7 +9,9 @@
 #include <vector>
 #include <algorithm>
 #include <cstdarg>
+#include <limits>
 #include <memory>
+#include <sstream>
 
 namespace utils {
 
@@ -72,7 +74,7 @@ inline std::string::size_type sep_size(const std::string& s) {
     return s.size();
 }
 
-inline std::string::size_type sep_size(const char& c) {
+inline std::string::size_type sep_size(const char&) {
     return 1;
 }
 